@@ -0,0 +1,25 @@
+namespace ns {
+struct Foo {
+    void bar(int);
+    void barbaz();
+};
+void Foo::bar(int) {}
+void Foo::barbaz() {}
+}
+
+template <typename T>
+struct Vec {
+    void push(const T &);
+};
+template <typename T>
+void Vec<T>::push(const T &) {}
+
+int main()
+{
+    ns::Foo foo;
+    foo.bar(1);
+    foo.barbaz();
+    Vec<int> v;
+    v.push(1);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "BufferStore.h"
+
+#include "Location.h"
+#include "QueryMessage.h"
+#include "rct/Log.h"
+
+bool BufferStore::resolve(const std::shared_ptr<QueryMessage> &query, String *error)
+{
+    for (const auto &it : query->unsavedFileVersions()) {
+        const auto contents = query->unsavedFiles().find(it.first);
+        if (contents != query->unsavedFiles().end())
+            insert(it.first, it.second).contents = contents->second;
+    }
+
+    for (const auto &it : query->unsavedFileEdits()) {
+        auto found = mBuffers.find(it.first);
+        if (found == mBuffers.end()) {
+            *error = "No unsaved buffer for " + it.first;
+            return false;
+        }
+        Buffer &buffer = found->second;
+        for (const QueryMessage::UnsavedFileEdit &edit : it.second) {
+            if (edit.base != buffer.version) {
+                *error = String::format<256>("Unsaved buffer for %s is at version %llu, not %llu",
+                                             it.first.constData(), static_cast<unsigned long long>(buffer.version),
+                                             static_cast<unsigned long long>(edit.base));
+                mBuffers.erase(found);
+                return false;
+            }
+            const size_t size = buffer.contents.size();
+            if (edit.offset > size || edit.removed > size - edit.offset) {
+                *error = String::format<256>("Invalid edit for %s, %u bytes at %u in %zu",
+                                             it.first.constData(), edit.removed, edit.offset, size);
+                mBuffers.erase(found);
+                return false;
+            }
+            if (edit.removed || !edit.text.isEmpty())
+                buffer.contents.ref().replace(edit.offset, edit.removed, edit.text.ref());
+            buffer.version = edit.version;
+        }
+        buffer.lastUsed = ++mCounter;
+        query->setUnsavedFile(it.first, buffer.contents);
+    }
+    return true;
+}
+
+BufferStore::Buffer &BufferStore::insert(const Path &path, uint64_t version)
+{
+    if (!mBuffers.contains(path) && mBuffers.size() >= MaxBuffers) {
+        auto oldest = mBuffers.begin();
+        for (auto it = mBuffers.begin(); it != mBuffers.end(); ++it) {
+            if (it->second.lastUsed < oldest->second.lastUsed)
+                oldest = it;
+        }
+        mBuffers.erase(oldest);
+    }
+    Buffer &buffer = mBuffers[path];
+    buffer.version = version;
+    buffer.lastUsed = ++mCounter;
+    return buffer;
+}
+
+void BufferStore::retain(const Set<uint32_t> &fileIds)
+{
+    if (fileIds.isEmpty())
+        return;
+    auto it = mBuffers.begin();
+    while (it != mBuffers.end()) {
+        if (!fileIds.contains(Location::fileId(it->first))) {
+            it = mBuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef BufferStore_h
+#define BufferStore_h
+
+#include <memory>
+
+#include "rct/Hash.h"
+#include "rct/Path.h"
+#include "rct/Set.h"
+#include "rct/String.h"
+
+class QueryMessage;
+// rdm's copy of the unsaved buffers clients have sent with a version. Once
+// a buffer is here a client can send the edits it made since that version,
+// or just the version if nothing changed, instead of the whole buffer.
+class BufferStore
+{
+public:
+    BufferStore()
+        : mCounter(0)
+    {}
+
+    enum { MaxBuffers = 32 };
+
+    // Remembers the versioned contents in query and replaces its edits with
+    // the buffers they produce. A buffer whose edits don't apply is dropped
+    // and the client has to send all of it again.
+    bool resolve(const std::shared_ptr<QueryMessage> &query, String *error);
+    // Forgets the buffers that aren't in fileIds, if there are any
+    void retain(const Set<uint32_t> &fileIds);
+private:
+    struct Buffer {
+        uint64_t version, lastUsed;
+        String contents;
+    };
+    Buffer &insert(const Path &path, uint64_t version);
+
+    Hash<Path, Buffer> mBuffers;
+    uint64_t mCounter;
+};
+
+#endif
@@ -16,6 +16,7 @@
 #define RTAGS_SINGLE_THREAD
 #include "ClangIndexer.h"
 
+#include <sys/resource.h>
 #include <unistd.h>
 #if CINDEX_VERSION >= CINDEX_VERSION_ENCODE(0, 25)
 #include <clang-c/Documentation.h>
@@ -28,8 +29,14 @@
 #include "rct/Connection.h"
 #include "rct/EventLoop.h"
 #include "rct/SHA256.h"
+#include "rct/Thread.h"
 #include "RTags.h"
 #include "RTagsVersion.h"
+#include "SegmentedDatabase.h"
+#include "SharedMemory.h"
+#include "StringPool.h"
+#include "SymbolNameSuffix.h"
+#include "UnitManifest.h"
 #include "VisitFileMessage.h"
 #include "VisitFileResponseMessage.h"
 #include "Location.h"
@@ -76,14 +83,16 @@ struct VerboseVisitorUserData {
 
 Flags<Server::Option> ClangIndexer::sServerOpts;
 Path ClangIndexer::sServerSandboxRoot;
+bool ClangIndexer::sResident = false;
+Hash<uint32_t, ClangIndexer::ResidentUnit> ClangIndexer::sResidentUnits;
 ClangIndexer::ClangIndexer()
-    : mCurrentTranslationUnit(String::npos), mLastCursor(clang_getNullCursor()),
+    : mLastUnitFileId(0), mLastUnit(0), mCurrentTranslationUnit(String::npos), mLastCursor(clang_getNullCursor()),
       mLastCallExprSymbol(0), mVisitFileResponseMessageFileId(0),
       mVisitFileResponseMessageVisit(0), mParseDuration(0), mVisitDuration(0), mBlocked(0),
       mAllowed(0), mIndexed(1), mVisitFileTimeout(0), mIndexDataMessageTimeout(0),
-      mFileIdsQueried(0), mFileIdsQueriedTime(0), mCursorsVisited(0), mLogFile(0),
+      mFileIdsQueried(0), mFileIdsQueriedTime(0), mCursorsVisited(0), mDebugAllLocations(false), mLogFile(0),
       mConnection(Connection::create(RClient::NumOptions)), mUnionRecursion(false),
-      mInTemplateFunction(0)
+      mInTemplateFunction(0), mDeclarationHits(0), mDeclarationMisses(0), mReparsed(false)
 {
     mConnection->newMessage().connect(std::bind(&ClangIndexer::onMessage, this,
                                                 std::placeholders::_1, std::placeholders::_2));
@@ -95,6 +104,18 @@ ClangIndexer::~ClangIndexer()
         fclose(mLogFile);
 }
 
+void ClangIndexer::retainResidentUnits(const Set<uint32_t> &fileIds)
+{
+    auto it = sResidentUnits.begin();
+    while (it != sResidentUnits.end()) {
+        if (!fileIds.contains(it->first)) {
+            sResidentUnits.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
 bool ClangIndexer::exec(const String &data)
 {
     Deserializer deserializer(data);
@@ -129,15 +150,29 @@ bool ClangIndexer::exec(const String &data)
     deserializer >> connectAttempts;
     deserializer >> niceValue;
     deserializer >> sServerOpts;
-    deserializer >> mUnsavedFiles;
+    String err;
+    if (!SharedMemory::decodeUnsavedFiles(deserializer, mUnsavedFiles, &err)) {
+        error() << "Failed to read unsaved files" << err;
+        return false;
+    }
     deserializer >> mDataDir;
-    deserializer >> mDebugLocations;
+    List<String> debugLocations;
+    deserializer >> debugLocations;
     deserializer >> blockedFiles;
 
     if (sServerOpts & Server::NoRealPath) {
         Path::setRealPathEnabled(false);
     }
 
+    for (const String &debug : debugLocations) {
+        DebugLocation loc;
+        if (debug == "all") {
+            mDebugAllLocations = true;
+        } else if (Location::parse(debug, Path(), Path::RealPath, &loc.path, &loc.line, &loc.column)) {
+            mDebugLocations.append(loc);
+        }
+    }
+
 #if 0
     while (true) {
         FILE *f = fopen((String("/tmp/stop_") + mSourceFile.fileName()).constData(), "r+");
@@ -154,7 +189,9 @@ bool ClangIndexer::exec(const String &data)
 
     const uint64_t parseTime = Rct::currentTimeMs();
 
-    if (niceValue != INT_MIN) {
+    static bool niced = false;
+    if (niceValue != INT_MIN && !niced) {
+        niced = true;
         errno = 0;
         if (nice(niceValue) == -1) {
             error() << "Failed to nice rp" << Rct::strerror();
@@ -212,7 +249,7 @@ bool ClangIndexer::exec(const String &data)
     mIndexDataMessage.files()[mSources.front().fileId] |= IndexDataMessage::Visited;
     parse() && visit() && diagnose();
     String message = mSourceFile.toTilde();
-    String err;
+    err.clear();
 
     StopWatch sw;
     int writeDuration = -1;
@@ -238,21 +275,30 @@ bool ClangIndexer::exec(const String &data)
     int symbolNameCount = 0;
     for (const auto &unit : mUnits) {
         cursorCount += unit.second->symbols.size();
-        symbolNameCount += unit.second->symbolNames.size();
+        symbolNameCount += unit.second->symbolNameCount;
     }
     if (hasUnit) {
         String queryData;
         if (mFileIdsQueried)
             queryData = String::format(", %d queried %dms", mFileIdsQueried, mFileIdsQueriedTime);
-        const char *format = "(%d syms, %d symNames, %d includes, %d of %d files, symbols: %d of %d, %d cursors, %zu bytes written%s%s) (%d/%d/%dms)";
+        const size_t fileLookups = fileCacheHits() + fileCacheMisses();
+        const size_t declarationLookups = mDeclarationHits + mDeclarationMisses;
+        const char *format = "(%d syms, %d symNames, %d includes, %d of %d files, symbols: %d of %d, %d cursors, %d cursors/s, %d%% file cache hits, %d%% of %zu declaration lookups cached, %zu strings interned in %zukb, %zu bytes written%s%s) (%d/%d/%dms)";
         message += String::format<1024>(format, cursorCount, symbolNameCount,
                                         mIndexDataMessage.includes().size(), mIndexed,
                                         mIndexDataMessage.files().size(), mAllowed,
                                         mAllowed + mBlocked, mCursorsVisited,
+                                        mVisitDuration ? static_cast<int>(mCursorsVisited * 1000ll / mVisitDuration) : mCursorsVisited,
+                                        fileLookups ? static_cast<int>(fileCacheHits() * 100 / fileLookups) : 0,
+                                        declarationLookups ? static_cast<int>(mDeclarationHits * 100 / declarationLookups) : 0,
+                                        declarationLookups,
+                                        mStrings.count(), mStrings.bytesAllocated() / 1024,
                                         mIndexDataMessage.bytesWritten(),
                                         queryData.constData(), mIndexDataMessage.flags() & IndexDataMessage::UsedPCH ? ", pch" : "",
                                         mParseDuration, mVisitDuration, writeDuration);
     }
+    if (mReparsed)
+        message += " (resident)";
     if (mIndexDataMessage.indexerJobFlags() & IndexerJob::Dirty) {
         message += " (dirty)";
     } else if (mIndexDataMessage.indexerJobFlags() & IndexerJob::Reindex) {
@@ -261,14 +307,28 @@ bool ClangIndexer::exec(const String &data)
 
 
     mIndexDataMessage.setMessage(message);
+    struct rusage usage;
+    // a resident rp's peak says nothing about this job
+    if (!sResident && !getrusage(RUSAGE_SELF, &usage)) {
+#ifdef OS_Darwin
+        mIndexDataMessage.setPeakMemory(usage.ru_maxrss);
+#else
+        mIndexDataMessage.setPeakMemory(static_cast<uint64_t>(usage.ru_maxrss) * 1024);
+#endif
+    }
     sw.restart();
+    err.clear();
+    if (!mIndexDataMessage.share(&err) && !err.isEmpty())
+        warning() << "Couldn't share IndexDataMessage" << mSourceFile << err;
     if (!mConnection->send(mIndexDataMessage)) {
         error() << "Couldn't send IndexDataMessage" << mSourceFile;
+        mIndexDataMessage.unshare();
         return false;
     }
     mConnection->finished().connect(std::bind(&EventLoop::quit, EventLoop::eventLoop()));
     if (EventLoop::eventLoop()->exec(mIndexDataMessageTimeout) == EventLoop::Timeout) {
         error() << "Timed out sending IndexDataMessage" << mSourceFile;
+        mIndexDataMessage.unshare();
         return false;
     }
     if (getenv("RDM_DEBUG_INDEXERMESSAGE"))
@@ -541,7 +601,7 @@ String ClangIndexer::addNamePermutations(const CXCursor &cursor, Location locati
         if (!trailer.isEmpty())
             ret += trailer;
         if (cursorType != RTags::Type_Reference) {
-            unit(location.fileId())->symbolNames[ret].insert(location);
+            unit(location.fileId())->insertSymbolName(mStrings.intern(ret), location);
         }
     } else {
         ret.assign(buf + cutoff, std::max<int>(0, sizeof(buf) - cutoff - 1));
@@ -557,21 +617,25 @@ String ClangIndexer::addNamePermutations(const CXCursor &cursor, Location locati
                &colonColonCount, colonColons);
     assert((templateStart != -1) == (templateEnd != -1));
 
+    // Only the qualified name (and the typed one) are stored, every "::"
+    // suffix of them is an entry in the suffix index pointing into them.
+    Unit *u = unit(location.fileId());
     // i == 0 --> with templates,
     // i == 1 without templates or without EnumConstantDecl part
     for (int i=0; i<2; ++i) {
+        const String qualified(buf + pos, std::max<int>(0, sizeof(buf) - pos - 1));
+        const uint32_t qualifiedName = mStrings.intern(qualified);
+        const uint32_t typedName = type.isEmpty() ? 0 : mStrings.intern(type + qualified);
         for (int j=0; j<colonColonCount; ++j) {
             const char *ch = buf + colonColons[j];
-            String name(ch, std::max<int>(0, sizeof(buf) - (ch - buf) - 1));
-            if (name.isEmpty())
+            if (!*ch)
                 continue;
-            unit(location.fileId())->symbolNames[name].insert(location);
+            const uint32_t offset = colonColons[j] - pos;
+            u->insertSymbolName(qualifiedName, location, offset, 0);
             if (originalKind == CXCursor_ObjCClassMethodDecl) {
-                const size_t idx = name.indexOf(':');
-                if (idx != String::npos && idx > 0) {
-                    name.resize(idx);
-                    unit(location.fileId())->symbolNames[name].insert(location);
-                }
+                const char *colon = strchr(ch, ':');
+                if (colon && colon > ch)
+                    u->insertSymbolName(mStrings.intern(ch, colon - ch), location);
             }
             if (!type.isEmpty() && (originalKind != CXCursor_ParmDecl || !strchr(ch, '('))) {
                 // We only want to add the type to the final declaration for ParmDecls
@@ -585,7 +649,11 @@ String ClangIndexer::addNamePermutations(const CXCursor &cursor, Location locati
                 // or
                 // void foo(int)::int bar
 
-                unit(location.fileId())->symbolNames[type + name].insert(location);
+                if (type.size() <= SymbolNameSuffix::MaxTypeLength) {
+                    u->insertSymbolName(typedName, location, type.size() + offset, type.size());
+                } else {
+                    u->insertSymbolName(mStrings.intern(type + ch), location);
+                }
             }
         }
 
@@ -689,6 +757,15 @@ CXChildVisitResult ClangIndexer::visitorHelper(CXCursor cursor, CXCursor, CXClie
     return CXChildVisit_Continue;
 }
 
+bool ClangIndexer::isDebugLocation(Location location) const
+{
+    for (const DebugLocation &debug : mDebugLocations) {
+        if (debug.line == location.line() && debug.column == location.column() && debug.path == location.path())
+            return true;
+    }
+    return false;
+}
+
 CXChildVisitResult ClangIndexer::indexVisitor(CXCursor cursor)
 {
     ++mCursorsVisited;
@@ -707,9 +784,10 @@ CXChildVisitResult ClangIndexer::indexVisitor(CXCursor cursor)
     }
 
     struct UpdateLastCursor {
-        ~UpdateLastCursor() { func(); }
-        std::function<void()> func;
-    } call = { [this, cursor]() { mLastCursor = cursor; } };
+        ~UpdateLastCursor() { *lastCursor = cursor; }
+        CXCursor *lastCursor;
+        const CXCursor cursor;
+    } call = { &mLastCursor, cursor };
 
     bool blocked = false;
 
@@ -721,15 +799,12 @@ CXChildVisitResult ClangIndexer::indexVisitor(CXCursor cursor)
         // error() << "Got null" << cursor;
         return CXChildVisit_Recurse;
     }
-    for (const String &debug : mDebugLocations) {
-        if (debug == "all" || debug == loc) {
-            Log log(LogLevel::Error);
-            log << cursor;
-            CXCursor ref = clang_getCursorReferenced(cursor);
-            if (!clang_isInvalid(clang_getCursorKind(ref)) && ref != cursor) {
-                log << "refs" << ref;
-            }
-            break;
+    if (mDebugAllLocations || (!mDebugLocations.isEmpty() && isDebugLocation(loc))) {
+        Log log(LogLevel::Error);
+        log << cursor;
+        CXCursor ref = clang_getCursorReferenced(cursor);
+        if (!clang_isInvalid(clang_getCursorKind(ref)) && ref != cursor) {
+            log << "refs" << ref;
         }
     }
     ++mAllowed;
@@ -987,7 +1062,7 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
     case CXCursor_Destructor:
     case CXCursor_FunctionTemplate: {
         bool visitReference = false;
-        ref = resolveTemplate(ref, refLoc, &visitReference);
+        ref = cachedResolveTemplate(ref, refLoc, &visitReference);
         if (visitReference && (kind == CXCursor_DeclRefExpr || kind == CXCursor_MemberRefExpr)) {
             mTemplateSpecializations.insert(originalRef);
         }
@@ -999,10 +1074,10 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
                 return false;
             }
         } else {
-            CXStringScope scope = clang_getCursorDisplayName(ref);
-            const char *data = scope.data();
-            if (data) {
-                const int len = strlen(data);
+            const String &displayName = cachedDisplayName(ref);
+            if (!displayName.isEmpty()) {
+                const char *data = displayName.constData();
+                const size_t len = displayName.size();
                 if (len > 8 && !strncmp(data, "operator", 8) && !isalnum(data[8]) && data[8] != '_') {
                     if (isImplicit(ref)) {
                         return false; // eat implicit operator calls
@@ -1016,7 +1091,7 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
         break;
     }
 
-    const String refUsr = usr(ref);
+    const String &refUsr = cachedUsr(ref);
     if (refUsr.isEmpty()) {
         return false;
     }
@@ -1056,9 +1131,9 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
         for (const auto &t : targets) {
             if (RTags::targetsValueKind(t.second) == CXCursor_MacroDefinition) {
                 for (const auto &u : mUnits) { // ### should only search the ones we depend on
-                    const auto it = u.second->usrs.find(t.first);
-                    if (it != u.second->usrs.end()) {
-                        auto mit = mMacroTokens.find(*it->second.begin());
+                    const auto it = u.second->usrLocations.find(mStrings.intern(t.first));
+                    if (it != u.second->usrLocations.end()) {
+                        auto mit = mMacroTokens.find(it->second);
                         if (mit != mMacroTokens.end()) {
                             const String id = RTags::eatString(clang_getCursorSpelling(cursor));
                             auto idit = mit->second.data.find(id);
@@ -1075,7 +1150,7 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
                                 } else {
                                     locs.remove(0, 1);
                                 }
-                                std::shared_ptr<Unit> uu = unit(location);
+                                Unit *uu = unit(location);
                                 c = &uu->symbols[location];
                                 Map<String, uint16_t> &tt = uu->targets[location];
                                 tt[refUsr] = refTargetValue;
@@ -1167,7 +1242,11 @@ bool ClangIndexer::handleReference(const CXCursor &cursor, CXCursorKind kind, Lo
             *cursorPtr = 0;
         return false;
     }
-    setType(*c, clang_getCursorType(kind == CXCursor_MemberRefExpr ? ref : cursor));
+    if (kind == CXCursor_MemberRefExpr) {
+        setCachedType(*c, ref);
+    } else {
+        setType(*c, clang_getCursorType(cursor));
+    }
     if (RTags::isFunction(refKind)) {
         mLastCallExprSymbol = c;
     }
@@ -1229,9 +1308,9 @@ std::unordered_set<CXCursor> ClangIndexer::addOverriddenCursors(const CXCursor &
             for (unsigned int i=0; i<count; ++i) {
                 // error() << location << "got" << i << count << loc;
 
-                const CXCursor resolved = resolveTemplate(overridden[i]);
+                const CXCursor resolved = cachedResolveTemplate(overridden[i]);
                 ret.insert(resolved);
-                const String usr = ::usr(resolved);
+                const String &usr = cachedUsr(resolved);
                 assert(!usr.isEmpty());
                 // assert(!locCursor.usr.isEmpty());
 
@@ -1261,8 +1340,8 @@ void ClangIndexer::handleInclude(const CXCursor &cursor, CXCursorKind kind, Loca
             String include = "#include ";
             Path path = refLoc.path();
             assert(mSources.front().fileId);
-            unit(location)->symbolNames[(include + path)].insert(location);
-            unit(location)->symbolNames[(include + path.fileName())].insert(location);
+            unit(location)->insertSymbolName(mStrings.intern(include + path), location);
+            unit(location)->insertSymbolName(mStrings.intern(include + path.fileName()), location);
             mIndexDataMessage.includes().push_back(std::make_pair(location.fileId(), refLoc.fileId()));
             c.symbolName = "#include " + RTags::eatString(clang_getCursorDisplayName(cursor));
             c.kind = cursor.kind;
@@ -1315,7 +1394,7 @@ void ClangIndexer::handleLiteral(const CXCursor &cursor, CXCursorKind kind, Loca
         symbolName = RTags::eatString(clang_getCursorSpelling(cursor));
     }
     s.symbolName = symbolName;
-    u->symbolNames[symbolName].insert(location);
+    u->insertSymbolName(mStrings.intern(symbolName), location);
     s.symbolLength = symbolName.size();
 }
 
@@ -1360,7 +1439,7 @@ CXChildVisitResult ClangIndexer::handleStatement(const CXCursor &cursor, CXCurso
             if (scope.type == Scope::FunctionDefinition) {
                 c.kind = kind;
                 c.symbolName = "return";
-                u->symbolNames[c.symbolName].insert(location);
+                u->insertSymbolName(mStrings.intern(c.symbolName), location);
                 c.kind = kind;
                 c.symbolLength = 6;
                 c.location = location;
@@ -1390,7 +1469,7 @@ CXChildVisitResult ClangIndexer::handleStatement(const CXCursor &cursor, CXCurso
         case CXCursor_DoStmt: c.symbolName = "do"; break;
         default: assert(0); break;
         }
-        u->symbolNames[c.symbolName].insert(location);
+        u->insertSymbolName(mStrings.intern(c.symbolName), location);
         c.symbolLength = c.symbolName.size();
         c.location = location;
         if (kind != CXCursor_IfStmt) {
@@ -1428,7 +1507,7 @@ CXChildVisitResult ClangIndexer::handleStatement(const CXCursor &cursor, CXCurso
         }
         setRange(c, clang_getCursorExtent(cursor));
         c.symbolName = kind == CXCursor_BreakStmt ? "break" : "continue";
-        u->symbolNames[c.symbolName].insert(location);
+        u->insertSymbolName(mStrings.intern(c.symbolName), location);
         c.kind = kind;
         c.symbolLength = c.symbolName.size();
         c.location = location;
@@ -1454,14 +1533,14 @@ void ClangIndexer::handleBaseClassSpecifier(const CXCursor &cursor)
     }
 
     while (true) {
-        CXCursor tmp = resolveTypedef(resolveTemplate(ref));
+        CXCursor tmp = resolveTypedef(cachedResolveTemplate(ref));
         if (tmp == ref) {
             break;
         } else {
             ref = std::move(tmp);
         }
     }
-    const String usr = ::usr(ref);
+    const String &usr = cachedUsr(ref);
     if (usr.isEmpty()) {
         warning() << "Couldn't find usr for" << clang_getCursorReferenced(cursor) << cursor << mLastClass;
         return;
@@ -1492,7 +1571,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
                                               Location location, Symbol **cursorPtr)
 {
     auto tu = mTranslationUnits.at(mCurrentTranslationUnit)->unit;
-    const String usr = ::usr(cursor);
+    const String &usr = cachedUsr(cursor);
     // error() << "Got a cursor" << cursor;
     Symbol &c = unit(location)->symbols[location];
     if (cursorPtr)
@@ -1500,7 +1579,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
     if (!c.isNull()) {
         if (c.kind == CXCursor_MacroExpansion) {
             addNamePermutations(cursor, location, RTags::Type_Cursor);
-            unit(location)->usrs[usr].insert(location);
+            unit(location)->insertUsr(mStrings.intern(usr), location);
         }
         return CXChildVisit_Recurse;
     }
@@ -1616,7 +1695,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
             case CXCursor_ClassTemplate: {
                 const CXCursor destructor = RTags::findChild(referenced, CXCursor_Destructor);
                 if (RTags::isValid(destructor)) {
-                    const String destructorUsr = ::usr(destructor);
+                    const String &destructorUsr = cachedUsr(destructor);
                     assert(!destructorUsr.isEmpty());
                     const Location scopeEndLocation = mScopeStack.back().end;
                     auto u = unit(scopeEndLocation);
@@ -1750,7 +1829,7 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
     // their definition and their declaration.  Using the canonical
     // cursor's usr allows us to join them. Check JSClassRelease in
     // JavaScriptCore for an example.
-    unit(location)->usrs[c.usr].insert(location);
+    unit(location)->insertUsr(mStrings.intern(c.usr), location);
     if (c.linkage == CXLinkage_External && !c.isDefinition()) {
         switch (c.kind) {
         case CXCursor_FunctionDecl:
@@ -1834,15 +1913,15 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
         }
 
         // these are for joining constructors/destructor with their classes (for renaming symbols)
-        assert(!::usr(parent).isEmpty());
-        unit(location)->targets[location][::usr(parent)] = 0;
+        assert(!cachedUsr(parent).isEmpty());
+        unit(location)->targets[location][cachedUsr(parent)] = 0;
         break; }
     case CXCursor_ClassTemplate:
     case CXCursor_StructDecl:
     case CXCursor_ClassDecl: {
         const CXCursor specialization = clang_getSpecializedCursorTemplate(cursor);
         if (RTags::isValid(specialization)) {
-            unit(location)->targets[location][::usr(specialization)] = 0;
+            unit(location)->targets[location][cachedUsr(specialization)] = 0;
             c.flags |= Symbol::TemplateSpecialization;
         }
         break; }
@@ -1893,10 +1972,23 @@ CXChildVisitResult ClangIndexer::handleCursor(const CXCursor &cursor, CXCursorKi
     return CXChildVisit_Recurse;
 }
 
+class ParseThread : public Thread
+{
+public:
+    ParseThread(std::function<void()> &&func)
+        : mFunc(std::move(func))
+    {}
+
+    virtual void run() override { mFunc(); }
+private:
+    std::function<void()> mFunc;
+};
+
 bool ClangIndexer::parse()
 {
     StopWatch sw;
     assert(mTranslationUnits.isEmpty());
+    clearFileCache();
     Flags<Source::CommandLineFlag> commandLineFlags = Source::Default;
     if (ClangIndexer::serverOpts() & Server::PCHEnabled)
         commandLineFlags |= Source::PCHEnabled;
@@ -1936,8 +2028,12 @@ bool ClangIndexer::parse()
         };
     }
 
-    bool ok = false;
-    for (const Source &source : mSources) {
+    const bool resident = sResident && mIndexDataMessage.indexerJobFlags() & IndexerJob::Active && mSources.size() == 1;
+    const bool cache = !resident && mIndexDataMessage.indexerJobFlags() & IndexerJob::Active && serverOpts() & Server::TranslationUnitCache;
+    List<std::shared_ptr<RTags::TranslationUnit> > units(mSources.size());
+    List<List<String> > args(mSources.size());
+    for (size_t i=0; i<mSources.size(); ++i) {
+        const Source &source = mSources.at(i);
         if (testLog(LogLevel::Debug))
             debug() << "CI::parse: " << source.toCommandLine(commandLineFlags) << "\n";
 
@@ -1945,12 +2041,15 @@ bool ClangIndexer::parse()
         //     error("[%s]", it.constData());
         // }
         bool usedPch = false;
-        const List<String> args = source.toCommandLine(commandLineFlags, &usedPch);
+        args[i] = source.toCommandLine(commandLineFlags, &usedPch);
         if (usedPch)
             mIndexDataMessage.setFlag(IndexDataMessage::UsedPCH);
+    }
 
-        std::shared_ptr<RTags::TranslationUnit> unit;
-        if (mIndexDataMessage.indexerJobFlags() & IndexerJob::Active && serverOpts() & Server::TranslationUnitCache) {
+    auto parseBuild = [&](size_t i) {
+        std::shared_ptr<RTags::TranslationUnit> &unit = units[i];
+        // the cache only holds the first build
+        if (cache && !i) {
             Path path = mDataDir + "tucache/";
             Path::mkdir(path, Path::Recursive);
             path << mSources.front().fileId;
@@ -1967,8 +2066,46 @@ bool ClangIndexer::parse()
             }
         }
 
-        if (!unit)
-            unit = RTags::TranslationUnit::create(mSourceFile, args, &unsavedFiles[0], unsavedIndex, flags, false);
+        if (resident) {
+            const uint32_t fileId = mSources.front().fileId;
+            auto it = sResidentUnits.find(fileId);
+            if (it != sResidentUnits.end() && it->second.args != args[i]) {
+                // the command line changed, start over
+                sResidentUnits.erase(it);
+            } else if (it != sResidentUnits.end()) {
+                unit = it->second.unit;
+                if (unit->reparse(&unsavedFiles[0], unsavedIndex)) {
+                    mReparsed = true;
+                } else {
+                    error() << "Failed to reparse resident unit for" << mSourceFile;
+                    sResidentUnits.erase(it);
+                    unit.reset();
+                }
+            }
+        }
+
+        if (!unit) {
+            unit = RTags::TranslationUnit::create(mSourceFile, args[i], &unsavedFiles[0], unsavedIndex, flags, false);
+            if (resident && unit->unit)
+                sResidentUnits[mSources.front().fileId] = { args[i], unit };
+        }
+    };
+
+    // Every build gets its own CXIndex so they can be parsed side by
+    // side. The first one is parsed on this thread.
+    List<std::shared_ptr<ParseThread> > threads;
+    for (size_t i=1; i<mSources.size(); ++i) {
+        threads.append(std::make_shared<ParseThread>(std::bind(parseBuild, i)));
+        threads.back()->start(Thread::Normal, 8 * 1024 * 1024); // 8MiB stack size
+    }
+    parseBuild(0);
+    for (const auto &thread : threads)
+        thread->join();
+
+    bool ok = false;
+    for (size_t i=0; i<mSources.size(); ++i) {
+        const Source &source = mSources.at(i);
+        const std::shared_ptr<RTags::TranslationUnit> &unit = units.at(i);
         mTranslationUnits.push_back(unit);
 
         warning() << "CI::parse loading unit:" << unit->clangLine << " " << (unit->unit != 0);
@@ -1982,7 +2119,7 @@ bool ClangIndexer::parse()
                 clang_saveTranslationUnit(unit->unit, tmp.constData(), clang_defaultSaveOptions(unit->unit));
                 rename(tmp.constData(), path.constData());
                 warning() << "SAVED PCH" << path;
-            } else if (!mSerializeTU && mIndexDataMessage.indexerJobFlags() & IndexerJob::Active && serverOpts() & Server::TranslationUnitCache) {
+            } else if (!mSerializeTU && cache) {
                 mSerializeTU = unit;
             }
 
@@ -1996,25 +2133,124 @@ bool ClangIndexer::parse()
     return ok;
 }
 
-static inline Map<String, Set<Location> > convertTargets(const Map<Location, Map<String, uint16_t> > &in, bool hasRoot)
+// Sorted by key like the Map<String, Set<Location> > FileMap expects
+struct NameTableEntry
 {
-    Map<String, Set<Location> > ret;
-    if (hasRoot) {
-        for (const auto &v : in) {
-            for (const auto &u : v.second) {
-                ret[Sandbox::encoded(u.first)].insert(v.first);
-            }
+    String first;
+    Set<Location> second;
+    uint32_t name;
+    bool encoded;
+};
+typedef List<NameTableEntry> NameTable;
+
+static NameTable createNameTable(List<std::pair<uint32_t, Location> > &entries, const StringPool &strings, bool hasRoot)
+{
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+    NameTable ret;
+    for (size_t i=0; i<entries.size(); ) {
+        NameTableEntry entry;
+        entry.name = entries[i].first;
+        entry.first = strings.string(entry.name);
+        entry.encoded = hasRoot && Sandbox::encode(entry.first);
+        do {
+            entry.second.insert(entry.second.end(), entries[i].second);
+        } while (++i < entries.size() && entries[i].first == entry.name);
+        ret.append(std::move(entry));
+    }
+    std::sort(ret.begin(), ret.end(), [](const NameTableEntry &l, const NameTableEntry &r) {
+            return l.first < r.first;
+        });
+
+    // two names can only end up the same if encoding made them so
+    size_t out = 0;
+    for (size_t i=0; i<ret.size(); ++i) {
+        if (out && ret[out - 1].first == ret[i].first) {
+            ret[out - 1].second.unite(ret[i].second);
+            ret[out - 1].encoded = true;
+        } else {
+            if (out != i)
+                ret[out] = std::move(ret[i]);
+            ++out;
         }
-    } else {
-        for (const auto &v : in) {
-            for (const auto &u : v.second) {
-                ret[u.first].insert(v.first);
+    }
+    ret.resize(out);
+    return ret;
+}
+
+static inline NameTable convertTargets(const Map<Location, Map<String, uint16_t> > &in, StringPool &strings, bool hasRoot)
+{
+    List<std::pair<uint32_t, Location> > entries;
+    for (const auto &v : in) {
+        for (const auto &u : v.second) {
+            entries.append(std::make_pair(strings.intern(u.first), v.first));
+        }
+    }
+    return createNameTable(entries, strings, hasRoot);
+}
+
+// Names whose encoding changed only get their whole-name entry, the suffix
+// offsets don't apply anymore.
+static List<std::pair<uint32_t, uint64_t> > createSymbolNameSuffixes(const NameTable &symbolNames,
+                                                                    List<std::pair<uint32_t, uint64_t> > &suffixes)
+{
+    std::sort(suffixes.begin(), suffixes.end());
+    suffixes.erase(std::unique(suffixes.begin(), suffixes.end()), suffixes.end());
+
+    List<uint64_t> sorted;
+    sorted.reserve(std::max(symbolNames.size(), suffixes.size()));
+    for (size_t keyIndex=0; keyIndex<symbolNames.size(); ++keyIndex) {
+        const NameTableEntry &name = symbolNames[keyIndex];
+        auto it = suffixes.end();
+        if (!name.encoded)
+            it = std::lower_bound(suffixes.begin(), suffixes.end(), std::make_pair(name.name, static_cast<uint64_t>(0)));
+        if (it == suffixes.end() || it->first != name.name) {
+            sorted.append(SymbolNameSuffix::pack(keyIndex, 0, 0));
+            continue;
+        }
+        while (it != suffixes.end() && it->first == name.name) {
+            const uint32_t offset = static_cast<uint32_t>(it->second >> 32);
+            const uint32_t typeLength = static_cast<uint32_t>(it->second);
+            if (offset > SymbolNameSuffix::MaxOffset || typeLength > SymbolNameSuffix::MaxTypeLength) {
+                sorted.append(SymbolNameSuffix::pack(keyIndex, 0, 0));
+            } else {
+                sorted.append(SymbolNameSuffix::pack(keyIndex, offset, typeLength));
             }
+            ++it;
         }
     }
+    std::sort(sorted.begin(), sorted.end(), [&symbolNames](uint64_t l, uint64_t r) {
+            const int cmp = SymbolNameSuffix::compare(SymbolNameSuffix::Name(symbolNames[SymbolNameSuffix::keyIndex(l)].first, l),
+                                                      SymbolNameSuffix::Name(symbolNames[SymbolNameSuffix::keyIndex(r)].first, r));
+            return cmp ? cmp < 0 : l < r;
+        });
+
+    List<std::pair<uint32_t, uint64_t> > ret;
+    ret.reserve(sorted.size());
+    uint32_t idx = 0;
+    for (uint64_t entry : sorted)
+        ret.append(std::make_pair(idx++, entry));
     return ret;
 }
 
+// A file that was tokenized more than once keeps its last tokens
+static void sortTokens(List<std::pair<uint32_t, uint32_t> > &tokens)
+{
+    std::stable_sort(tokens.begin(), tokens.end(), [](const std::pair<uint32_t, uint32_t> &l, const std::pair<uint32_t, uint32_t> &r) {
+            return l.first < r.first;
+        });
+    size_t out = 0;
+    for (size_t i=0; i<tokens.size(); ++i) {
+        if (i + 1 < tokens.size() && tokens[i + 1].first == tokens[i].first)
+            continue;
+        if (out != i)
+            tokens[out] = std::move(tokens[i]);
+        ++out;
+    }
+    tokens.resize(out);
+}
+
 static inline void encodeSymbols(Map<Location, Symbol> &symbols)
 {
     assert(Sandbox::hasRoot());
@@ -2033,27 +2269,40 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
     const Path p = Sandbox::encoded(mSourceFile);
     const bool hasRoot = Sandbox::hasRoot();
     const uint32_t fileId = mSources.front().fileId;
+    const bool segmented = ClangIndexer::serverOpts() & Server::SegmentedStorage;
+    const bool lazyTokens = ClangIndexer::serverOpts() & Server::LazyTokens;
+    List<SegmentedDatabase::Record> records;
 
     auto process = [&](Hash<uint32_t, std::shared_ptr<Unit> >::const_iterator unit) {
         assert(mIndexDataMessage.files().value(unit->first) & IndexDataMessage::Visited);
         String unitRoot = root;
         unitRoot << unit->first;
-        Path::mkdir(unitRoot, Path::Recursive);
+        if (!segmented)
+            Path::mkdir(unitRoot, Path::Recursive);
         const Path path = Location::path(unit->first);
         if (unit->first != fileId) {
-            FILE *f = fopen((unitRoot + "/info").constData(), "w");
-            if (!f)
-                return false;
             Path rpath = path;
             Sandbox::encode(rpath);
-            bytesWritten += fprintf(f, "%s\nIndexed by %s at %llu\n",
-                                    rpath.constData(),
-                                    p.constData(), static_cast<unsigned long long>(mIndexDataMessage.parseTime()));
-            fclose(f);
+            const String info = String::format<1024>("%s\nIndexed by %s at %llu\n",
+                                                     rpath.constData(),
+                                                     p.constData(), static_cast<unsigned long long>(mIndexDataMessage.parseTime()));
+            if (segmented) {
+                records.append({ unit->first, SegmentedDatabase::Type_Info, info });
+            } else {
+                FILE *f = fopen((unitRoot + "/info").constData(), "w");
+                if (!f)
+                    return false;
+                fwrite(info.constData(), info.size(), 1, f);
+                fclose(f);
+                bytesWritten += info.size();
+            }
         }
 
         auto uit = mUnsavedFiles.find(path);
-        if (uit == mUnsavedFiles.end()) {
+        if (segmented) {
+            // an empty unsaved record replaces whatever we had before
+            records.append({ unit->first, SegmentedDatabase::Type_Unsaved, uit == mUnsavedFiles.end() ? String() : uit->second });
+        } else if (uit == mUnsavedFiles.end()) {
             Path::rm(unitRoot + "/unsaved");
         } else {
             FILE *f = fopen((unitRoot + "/unsaved").constData(), "w");
@@ -2074,12 +2323,39 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
         if (ClangIndexer::serverOpts() & Server::NoFileLock)
             fileMapOpts |= FileMap<int, int>::NoLock;
 
-        if (hasRoot) {
+        if (hasRoot)
             encodeSymbols(unit->second->symbols);
-            Sandbox::encode(unit->second->usrs);
-            Sandbox::encode(unit->second->symbolNames);
+        const NameTable targets = convertTargets(unit->second->targets, mStrings, hasRoot);
+        const NameTable usrs = createNameTable(unit->second->usrs, mStrings, hasRoot);
+        const NameTable symbolNames = createNameTable(unit->second->symbolNames, mStrings, hasRoot);
+        const List<std::pair<uint32_t, uint64_t> > symbolNameSuffixes = createSymbolNameSuffixes(symbolNames,
+                                                                                                unit->second->symbolNameSuffixes);
+        unit->second->symbolNameCount = symbolNames.size();
+        sortTokens(unit->second->tokens);
+
+        if (segmented) {
+            records.append({ unit->first, SegmentedDatabase::Type_Symbols,
+                        FileMap<Location, Symbol>::encode(unit->second->symbols) });
+            records.append({ unit->first, SegmentedDatabase::Type_Targets,
+                        FileMap<String, Set<Location> >::encode(targets) });
+            records.append({ unit->first, SegmentedDatabase::Type_Usrs,
+                        FileMap<String, Set<Location> >::encode(usrs) });
+            records.append({ unit->first, SegmentedDatabase::Type_SymbolNames,
+                        FileMap<String, Set<Location> >::encode(symbolNames) });
+            records.append({ unit->first, SegmentedDatabase::Type_SymbolNameSuffixes,
+                        FileMap<uint32_t, uint64_t>::encode(symbolNameSuffixes) });
+            // an empty record means rdm has to tokenize the file itself
+            records.append({ unit->first, SegmentedDatabase::Type_Tokens,
+                        lazyTokens ? String() : FileMap<uint32_t, uint32_t>::encode(unit->second->tokens) });
+            return true;
         }
 
+        // rdm only trusts the maps once there's a manifest from this job
+        const Path manifestPath = unitRoot + "/" + UnitManifest::fileName();
+        Path::rm(manifestPath);
+        UnitManifest manifest;
+        manifest.setGeneration(UnitManifest::generation(mIndexDataMessage.id(), mIndexDataMessage.parseTime()));
+
         size_t w;
         // for (const char *name : { "/symbols", "/targets", "/usrs", "/symnames", "/tokens" }) {
         //     if (Path::exists(unitRoot + "/symbols"))
@@ -2090,30 +2366,48 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
             return false;
         }
         bytesWritten += w;
+        manifest.insert("symbols", w, unit->second->symbols.size());
 
-        if (!(w = FileMap<String, Set<Location> >::write(unitRoot + "/targets", convertTargets(unit->second->targets, hasRoot), fileMapOpts))) {
+        if (!(w = FileMap<String, Set<Location> >::write(unitRoot + "/targets", targets, fileMapOpts))) {
             error = "Failed to write targets";
             return false;
         }
         bytesWritten += w;
+        manifest.insert("targets", w, targets.size());
 
-        if (!(w += FileMap<String, Set<Location> >::write(unitRoot + "/usrs", unit->second->usrs, fileMapOpts))) {
+        if (!(w = FileMap<String, Set<Location> >::write(unitRoot + "/usrs", usrs, fileMapOpts))) {
             error = "Failed to write usrs";
             return false;
         }
         bytesWritten += w;
+        manifest.insert("usrs", w, usrs.size());
 
-        if (!(w += FileMap<String, Set<Location> >::write(unitRoot + "/symnames", unit->second->symbolNames, fileMapOpts))) {
+        if (!(w = FileMap<String, Set<Location> >::write(unitRoot + "/symnames", symbolNames, fileMapOpts))) {
             error = "Failed to write symbolNames";
             return false;
         }
         bytesWritten += w;
+        manifest.insert("symnames", w, symbolNames.size());
 
-        if (!(w += FileMap<uint32_t, Token>::write(unitRoot + "/tokens", unit->second->tokens, fileMapOpts))) {
-            error = "Failed to write symbolNames";
+        if (!(w = FileMap<uint32_t, uint64_t>::write(unitRoot + "/symsuffixes", symbolNameSuffixes, fileMapOpts))) {
+            error = "Failed to write symbolNameSuffixes";
             return false;
         }
         bytesWritten += w;
+        manifest.insert("symsuffixes", w, symbolNameSuffixes.size());
+
+        if (lazyTokens) {
+            // stale tokens would point into the old contents
+            Path::rm(unitRoot + "/tokens");
+            w = 0;
+        } else if (!(w = FileMap<uint32_t, uint32_t>::write(unitRoot + "/tokens", unit->second->tokens, fileMapOpts))) {
+            error = "Failed to write tokens";
+            return false;
+        }
+        bytesWritten += w;
+
+        if (!manifest.write(manifestPath, &error))
+            return false;
         return true;
     };
 
@@ -2146,23 +2440,35 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
             return false;
         }
     }
-    String sourceRoot = root;
-    sourceRoot << fileId;
-    Path::mkdir(sourceRoot, Path::Recursive);
-    sourceRoot << "/info";
-    FILE *f = fopen(sourceRoot.constData(), "w");
-    if (!f) {
-        return false;
-    }
-
+    String info;
     for (const Source &source : mSources) {
         const String args = Sandbox::encoded(String::join(source.toCommandLine(Source::Default|Source::IncludeCompiler|Source::IncludeSourceFile), ' '));
 
-        bytesWritten += fprintf(f, "%s\n%s\n", p.constData(), args.constData());
+        info << p << '\n' << args << '\n';
+    }
+    info << String::format<64>("Indexed at %llu\n", static_cast<unsigned long long>(mIndexDataMessage.parseTime()));
+
+    if (segmented) {
+        records.append({ fileId, SegmentedDatabase::Type_Info, info });
+        const Path segment = SegmentedDatabase::segmentPath(RTags::encodeSourceFilePath(mDataDir, mProject));
+        const size_t w = SegmentedDatabase::append(segment, records, mIndexDataMessage.parseTime(), &error);
+        if (!w)
+            return false;
+        bytesWritten += w;
+    } else {
+        String sourceRoot = root;
+        sourceRoot << fileId;
+        Path::mkdir(sourceRoot, Path::Recursive);
+        sourceRoot << "/info";
+        FILE *f = fopen(sourceRoot.constData(), "w");
+        if (!f) {
+            return false;
+        }
+        fwrite(info.constData(), info.size(), 1, f);
+        fclose(f);
+        bytesWritten += info.size();
     }
-    bytesWritten += fprintf(f, "Indexed at %llu\n", static_cast<unsigned long long>(mIndexDataMessage.parseTime()));
 
-    fclose(f);
     mIndexDataMessage.setBytesWritten(bytesWritten);
     return true;
 }
@@ -2170,6 +2476,8 @@ bool ClangIndexer::writeFiles(const Path &root, String &error)
 bool ClangIndexer::diagnose()
 {
     DiagnosticsProvider::diagnose();
+    if (ClangIndexer::serverOpts() & Server::LazyTokens)
+        return true;
     for (size_t i=0; i<mTranslationUnits.size(); ++i) {
         mCurrentTranslationUnit = i;
         auto tu = mTranslationUnits.at(mCurrentTranslationUnit)->unit;
@@ -2194,31 +2502,7 @@ bool ClangIndexer::diagnose()
 void ClangIndexer::tokenize(CXFile file, uint32_t fileId, const Path &path)
 {
     const auto &tu = mTranslationUnits.at(mCurrentTranslationUnit)->unit;
-    StopWatch sw;
-    const CXSourceLocation startLoc = clang_getLocationForOffset(tu, file, 0);
-    const CXSourceLocation endLoc = clang_getLocationForOffset(tu, file, path.fileSize());
-
-    CXSourceRange range = clang_getRange(startLoc, endLoc);
-    CXToken *tokens = 0;
-    unsigned numTokens = 0;
-    auto &map = unit(fileId)->tokens;
-    clang_tokenize(tu, range, &tokens, &numTokens);
-    for (unsigned i=0; i<numTokens; ++i) {
-        range = clang_getTokenExtent(tu, tokens[i]);
-        unsigned offset, endOffset;
-        const CXSourceLocation start = clang_getRangeStart(range);
-        clang_getSpellingLocation(start, 0, 0, 0, &offset);
-        clang_getSpellingLocation(clang_getRangeEnd(range), 0, 0, 0, &endOffset);
-        map[offset] = {
-            clang_getTokenKind(tokens[i]),
-            RTags::eatString(clang_getTokenSpelling(tu, tokens[i])),
-            createLocation(start),
-            offset,
-            endOffset - offset
-        };
-    }
-
-    clang_disposeTokens(tu, tokens, numTokens);
+    RTags::tokenize(tu, file, path.fileSize(), unit(fileId)->tokens);
 }
 
 bool ClangIndexer::visit()
@@ -2226,6 +2510,7 @@ bool ClangIndexer::visit()
     StopWatch watch;
     for (size_t i=0; i<mTranslationUnits.size(); ++i) {
         mCurrentTranslationUnit = i;
+        mDeclarations.clear();
         const auto &unit = mTranslationUnits.at(mCurrentTranslationUnit);
         assert(mSources.front().fileId);
         if (!unit->unit) {
@@ -2278,7 +2563,7 @@ bool ClangIndexer::visit()
             bool ignored;
             const Location loc = createLocation(cursor, kind, &ignored);
             if (!loc.isNull()) {
-                const String refUsr = usr(resolveTemplate(ref));
+                const String &refUsr = cachedUsr(cachedResolveTemplate(ref));
                 if (!refUsr.isEmpty()) {
                     assert(!refUsr.isEmpty());
                     const uint32_t fileId = mSources.front().fileId;
@@ -2340,9 +2625,9 @@ void ClangIndexer::addFileSymbol(uint32_t file)
     const Location loc(file, 1, 1);
     const Path path = Location::path(file);
     auto ref = unit(loc);
-    ref->symbolNames[path].insert(loc);
+    ref->insertSymbolName(mStrings.intern(path), loc);
     const char *fn = path.fileName();
-    ref->symbolNames[fn].insert(loc);
+    ref->insertSymbolName(mStrings.intern(fn), loc);
     Symbol &sym = ref->symbols[loc];
     if (sym.isNull())
         sym.flags |= Symbol::FileSymbol;
@@ -2424,6 +2709,66 @@ CXCursor ClangIndexer::resolveTemplate(CXCursor cursor, Location location, bool
     return cursor;
 }
 
+const String &ClangIndexer::cachedUsr(const CXCursor &cursor)
+{
+    Declaration &decl = mDeclarations[cursor];
+    if (decl.flags & Declaration::HasUsr) {
+        ++mDeclarationHits;
+    } else {
+        ++mDeclarationMisses;
+        decl.usr = ::usr(cursor);
+        decl.flags |= Declaration::HasUsr;
+    }
+    return decl.usr;
+}
+
+CXCursor ClangIndexer::cachedResolveTemplate(const CXCursor &cursor, Location location, bool *specialized)
+{
+    Declaration &decl = mDeclarations[cursor];
+    if (decl.flags & Declaration::HasTemplate) {
+        ++mDeclarationHits;
+    } else {
+        ++mDeclarationMisses;
+        // location is only a shortcut for createLocation(cursor), the
+        // result doesn't depend on it
+        bool spec;
+        decl.resolved = resolveTemplate(cursor, location, &spec);
+        decl.flags |= Declaration::HasTemplate | (spec ? Declaration::Specialized : 0);
+    }
+    if (specialized)
+        *specialized = decl.flags & Declaration::Specialized;
+    return decl.resolved;
+}
+
+const String &ClangIndexer::cachedDisplayName(const CXCursor &cursor)
+{
+    Declaration &decl = mDeclarations[cursor];
+    if (decl.flags & Declaration::HasDisplayName) {
+        ++mDeclarationHits;
+    } else {
+        ++mDeclarationMisses;
+        decl.displayName = RTags::eatString(clang_getCursorDisplayName(cursor));
+        decl.flags |= Declaration::HasDisplayName;
+    }
+    return decl.displayName;
+}
+
+void ClangIndexer::setCachedType(Symbol &symbol, const CXCursor &cursor)
+{
+    Declaration &decl = mDeclarations[cursor];
+    if (decl.flags & Declaration::HasType) {
+        ++mDeclarationHits;
+        symbol.type = decl.typeKind;
+        symbol.typeName = decl.typeName;
+    } else {
+        ++mDeclarationMisses;
+        setType(symbol, clang_getCursorType(cursor));
+        decl.typeKind = symbol.type;
+        decl.typeName = symbol.typeName;
+        decl.flags |= Declaration::HasType;
+    }
+}
+
 CXCursor ClangIndexer::resolveTypedef(CXCursor cursor)
 {
     while (clang_getCursorKind(cursor) == CXCursor_TypedefDecl) {
@@ -25,6 +25,7 @@
 #include "rct/StopWatch.h"
 #include "RTags.h"
 #include "Server.h"
+#include "StringPool.h"
 #include "Symbol.h"
 #include <unordered_set>
 
@@ -37,6 +38,10 @@ public:
 
     bool exec(const String &data);
     static Flags<Server::Option> serverOpts() { return sServerOpts; }
+    // rp --resident, keeps the translation units of active buffers around
+    // between jobs and reparses them
+    static void setResident(bool resident) { sResident = resident; }
+    static void retainResidentUnits(const Set<uint32_t> &fileIds);
     static const Path &serverSandboxRoot() { return sServerSandboxRoot; }
 private:
     bool diagnose();
@@ -107,22 +112,55 @@ private:
     void onMessage(const std::shared_ptr<Message> &msg, const std::shared_ptr<Connection> &conn);
 
     struct Unit {
+        Unit()
+            : symbolNameCount(0)
+        {}
         Map<Location, Symbol> symbols;
         Map<Location, Map<String, uint16_t> > targets;
-        Map<String, Set<Location> > usrs;
-        Map<String, Set<Location> > symbolNames;
-        Map<uint32_t, Token> tokens;
+        // Names are interned in mStrings and only appended while visiting,
+        // writeFiles sorts them and drops the duplicates.
+        List<std::pair<uint32_t, Location> > usrs, symbolNames;
+        // (offset << 32) | typeLength into the name, names without any
+        // entries can only be looked up as a whole
+        List<std::pair<uint32_t, uint64_t> > symbolNameSuffixes;
+        // first location of each usr
+        Hash<uint32_t, Location> usrLocations;
+        List<std::pair<uint32_t, uint32_t> > tokens;
+        size_t symbolNameCount;
+
+        void insertUsr(uint32_t usr, Location location)
+        {
+            usrs.append(std::make_pair(usr, location));
+            Location &first = usrLocations[usr];
+            if (first.isNull() || location < first)
+                first = location;
+        }
+        void insertSymbolName(uint32_t name, Location location)
+        {
+            symbolNames.append(std::make_pair(name, location));
+        }
+        void insertSymbolName(uint32_t name, Location location, uint32_t offset, uint32_t typeLength)
+        {
+            symbolNames.append(std::make_pair(name, location));
+            symbolNameSuffixes.append(std::make_pair(name, (static_cast<uint64_t>(offset) << 32) | typeLength));
+        }
     };
 
-    std::shared_ptr<Unit> &unit(uint32_t fileId)
+    // Called for every symbol, target and name we insert and almost always
+    // for the same file as the last time so remember that one.
+    Unit *unit(uint32_t fileId)
     {
+        if (mLastUnit && fileId == mLastUnitFileId)
+            return mLastUnit;
         std::shared_ptr<Unit> &unit = mUnits[fileId];
         if (!unit) {
             unit.reset(new Unit);
         }
-        return unit;
+        mLastUnitFileId = fileId;
+        mLastUnit = unit.get();
+        return mLastUnit;
     }
-    std::shared_ptr<Unit> unit(Location loc) { return unit(loc.fileId()); }
+    Unit *unit(Location loc) { return unit(loc.fileId()); }
 
     enum FindResult {
         Found,
@@ -142,6 +180,9 @@ private:
     Map<Location, MacroData> mMacroTokens;
 
     Hash<uint32_t, std::shared_ptr<Unit> > mUnits;
+    uint32_t mLastUnitFileId;
+    Unit *mLastUnit;
+    StringPool mStrings;
 
     Path mProject;
     SourceList mSources;
@@ -160,7 +201,15 @@ private:
         mIndexed, mVisitFileTimeout, mIndexDataMessageTimeout,
         mFileIdsQueried, mFileIdsQueriedTime, mCursorsVisited;
     UnsavedFiles mUnsavedFiles;
-    List<String> mDebugLocations;
+    // --debug-locations, resolved once, the paths are only compared when
+    // line and column match
+    struct DebugLocation {
+        Path path;
+        uint32_t line, column;
+    };
+    List<DebugLocation> mDebugLocations;
+    bool mDebugAllLocations;
+    bool isDebugLocation(Location location) const;
     FILE *mLogFile;
     std::shared_ptr<Connection> mConnection;
     Path mDataDir;
@@ -189,8 +238,43 @@ private:
     std::unordered_set<CXCursor> mTemplateSpecializations;
     size_t mInTemplateFunction;
 
+    // What we derive from the declarations references point to. A heavily
+    // used class can be referenced hundreds of thousands of times in one
+    // translation unit, this saves asking libclang (and allocating a
+    // CXString) every time. Cleared for every translation unit.
+    struct Declaration {
+        enum Flag {
+            HasUsr = 0x01,
+            HasTemplate = 0x02,
+            HasDisplayName = 0x04,
+            HasType = 0x08,
+            Specialized = 0x10
+        };
+        Declaration()
+            : flags(0), typeKind(CXType_Invalid), resolved(clang_getNullCursor())
+        {}
+        unsigned int flags;
+        String usr, displayName, typeName;
+        CXTypeKind typeKind;
+        CXCursor resolved;
+    };
+    const String &cachedUsr(const CXCursor &cursor);
+    CXCursor cachedResolveTemplate(const CXCursor &cursor, Location location = Location(), bool *specialized = 0);
+    const String &cachedDisplayName(const CXCursor &cursor);
+    void setCachedType(Symbol &symbol, const CXCursor &cursor);
+    Hash<CXCursor, Declaration> mDeclarations;
+    size_t mDeclarationHits, mDeclarationMisses;
+
+    bool mReparsed;
+
     static Flags<Server::Option> sServerOpts;
     static Path sServerSandboxRoot;
+    static bool sResident;
+    struct ResidentUnit {
+        List<String> args;
+        std::shared_ptr<RTags::TranslationUnit> unit;
+    };
+    static Hash<uint32_t, ResidentUnit> sResidentUnits;
 };
 
 #endif
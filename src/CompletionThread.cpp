@@ -30,71 +30,118 @@
 using namespace nlohmann;
 #endif
 
-static uint64_t start = 0;
+static thread_local uint64_t start = 0;
 #define LOG()                                                           \
     if (Server::instance()->options().options & Server::CompletionLogs) \
         error() << "CODE COMPLETION" << String::format<16>("%gs", static_cast<double>(Rct::monoMs() - ::start) / 1000.0)
 
 
-CompletionThread::CompletionThread(int cacheSize)
-    : mShutdown(false), mCacheSize(cacheSize), mDump(0)
+class CompletionThread::Worker : public Thread
 {
+public:
+    Worker(CompletionThread *thread, Shard *shard)
+        : mThread(thread), mShard(shard)
+    {}
+    virtual void run() override { mThread->loop(mShard); }
+private:
+    CompletionThread *mThread;
+    Shard *mShard;
+};
+
+CompletionThread::CompletionThread(int cacheSize, int workerCount, size_t cacheMemory)
+    : mShutdown(false), mCacheSize(cacheSize), mCacheMemory(cacheMemory)
+{
+    const size_t count = std::max(1, workerCount);
+    // every worker gets its share of the cache, at least one unit
+    const size_t shardCacheSize = std::max<size_t>(1, (mCacheSize + count - 1) / count);
+    const size_t shardCacheMemory = mCacheMemory / count;
+    for (size_t i=0; i<count; ++i)
+        mShards.emplace_back(new Shard(i, shardCacheSize, shardCacheMemory));
 }
 
 CompletionThread::~CompletionThread()
 {
-    mCacheList.deleteAll();
 }
 
 void CompletionThread::run()
+{
+    List<std::shared_ptr<Worker> > workers;
+    for (size_t i=1; i<mShards.size(); ++i) {
+        workers.append(std::make_shared<Worker>(this, mShards[i].get()));
+        workers.back()->start();
+    }
+    loop(mShards.front().get());
+    for (const auto &worker : workers)
+        worker->join();
+}
+
+void CompletionThread::loop(Shard *shard)
 {
     while (true) {
         Request *request = 0;
         Dump *dump = 0;
+        size_t idle = 0;
         {
             std::unique_lock<std::mutex> lock(mMutex);
-            while (!mShutdown && mPending.isEmpty() && !mDump) {
-                mCondition.wait(lock);
+            while (!mShutdown && shard->pending.isEmpty() && shard->idle.isEmpty() && !shard->dump) {
+                shard->condition.wait(lock);
             }
             if (mShutdown) {
-                for (auto it = mPending.begin(); it != mPending.end(); ++it) {
+                for (auto it = shard->pending.begin(); it != shard->pending.end(); ++it) {
+                    delete *it;
+                }
+                shard->pending.clear();
+                for (auto it = shard->idle.begin(); it != shard->idle.end(); ++it) {
                     delete *it;
                 }
-                mPending.clear();
-                if (mDump) {
-                    std::unique_lock<std::mutex> dumpLock(mDump->mutex);
-                    mDump->done = true;
-                    mDump->cond.notify_one();
-                    mDump = 0;
+                shard->idle.clear();
+                if (shard->dump) {
+                    std::unique_lock<std::mutex> dumpLock(shard->dump->mutex);
+                    shard->dump->done = true;
+                    shard->dump->cond.notify_one();
+                    shard->dump = 0;
                 }
                 break;
-            } else if (mDump) {
-                std::swap(dump, mDump);
+            } else if (shard->dump) {
+                std::swap(dump, shard->dump);
+                idle = shard->idle.size();
+            } else if (!shard->pending.isEmpty()) {
+                request = shard->pending.takeFirst();
             } else {
-                assert(!mPending.isEmpty());
-                request = mPending.takeFirst();
+                assert(!shard->idle.isEmpty());
+                request = shard->idle.takeFirst();
             }
         }
         if (dump) {
             std::unique_lock<std::mutex> lock(dump->mutex);
             Log out(&dump->string);
-            for (SourceFile *cache = mCacheList.first(); cache; cache = cache->next) {
+            for (SourceFile *cache = shard->cacheList.first(); cache; cache = cache->next) {
                 out << cache->source
                     << "\nparseTime:" << cache->parseTime
                     << "\nreparseTime:" << cache->reparseTime
                     << "\ncompletions:" << cache->completions
+                    << "\ncachedCompletions:" << cache->cachedCompletions
                     << "\ncompletionTime:" << cache->codeCompleteTime
                     << (cache->completions
                         ? String::format<32>("(avg: %.2f)",
                                              (static_cast<double>(cache->codeCompleteTime) / cache->completions))
                         : String())
-                    << "\ntranslationUnit:" << cache->translationUnit << "\n";
+                    << "\nmemoryUsage:" << String::format<32>("%.1fMB", cache->memoryUsage / (1024.0 * 1024.0))
+                    << "\ncredit:" << String::format<32>("%.2f", cache->credit)
+                    << "\ntranslationUnit:" << cache->translationUnit
+                    << "\nworker:" << shard->index << "\n";
             }
+            out << String::format<128>("worker %zu: %zu/%zu units, %.1fMB",
+                                       shard->index, shard->cacheMap.size(), shard->cacheSize,
+                                       shard->memoryUsage / (1024.0 * 1024.0));
+            if (shard->memoryBudget)
+                out << String::format<32>("/%.1fMB", shard->memoryBudget / (1024.0 * 1024.0));
+            out << String::format<64>(", %zu speculative warm-ups queued\n", idle);
             dump->done = true;
             dump->cond.notify_one();
         } else {
             assert(request);
-            process(request);
+            process(shard, request);
             delete request;
         }
     }
@@ -108,60 +155,125 @@ void CompletionThread::completeAt(Source &&source, Location location,
     if (Server::instance()->options().options & Server::CompletionLogs)
         error() << "CODE COMPLETION completeAt" << location << flags;
     Request *request = new Request({ std::forward<Source>(source), location, flags, std::forward<String>(unsaved), prefix, conn});
+    Shard *s = shard(request->source.fileId);
     std::unique_lock<std::mutex> lock(mMutex);
-    auto it = mPending.begin();
-    while (it != mPending.end()) {
-        if ((*it)->source == source) {
+    auto it = s->pending.begin();
+    while (it != s->pending.end()) {
+        if ((*it)->source == request->source) {
             delete *it;
-            mPending.erase(it);
+            s->pending.erase(it);
             break;
         }
         ++it;
     }
-    mPending.push_front(request);
-    mCondition.notify_one();
+    for (it = s->idle.begin(); it != s->idle.end(); ++it) {
+        if ((*it)->source == request->source) {
+            delete *it;
+            s->idle.erase(it);
+            break;
+        }
+    }
+    s->pending.push_front(request);
+    s->condition.notify_one();
 }
 
 void CompletionThread::prepare(Source &&source, String &&unsaved)
 {
     if (Server::instance()->options().options & Server::CompletionLogs)
         error() << "CODE COMPLETION prepare" << source.sourceFile() << unsaved.size();
+    Shard *s = shard(source.fileId);
     std::unique_lock<std::mutex> lock(mMutex);
-    for (auto req : mPending) {
+    for (auto req : s->pending) {
         if (req->source == source) {
             req->unsaved = std::move(unsaved);
             return;
         }
     }
+    for (auto it = s->idle.begin(); it != s->idle.end(); ++it) {
+        if ((*it)->source == source) {
+            delete *it;
+            s->idle.erase(it);
+            break;
+        }
+    }
     Request *request = new Request({ std::forward<Source>(source), Location(), WarmUp, std::forward<String>(unsaved), String(), std::shared_ptr<Connection>() });
-    mPending.push_back(request);
-    mCondition.notify_one();
+    s->pending.push_back(request);
+    s->condition.notify_one();
+}
+
+void CompletionThread::prepareSpeculatively(Source &&source, String &&unsaved)
+{
+    if (Server::instance()->options().options & Server::CompletionLogs)
+        error() << "CODE COMPLETION prepare speculatively" << source.sourceFile() << unsaved.size();
+    Shard *s = shard(source.fileId);
+    std::unique_lock<std::mutex> lock(mMutex);
+    for (auto req : s->pending) {
+        if (req->source == source)
+            return;
+    }
+    for (auto req : s->idle) {
+        if (req->source == source) {
+            req->unsaved = std::move(unsaved);
+            return;
+        }
+    }
+    Request *request = new Request({ std::forward<Source>(source), Location(), WarmUp|Speculative, std::forward<String>(unsaved), String(), std::shared_ptr<Connection>() });
+    s->idle.push_back(request);
+    s->condition.notify_one();
 }
 
 String CompletionThread::dump()
 {
-    Dump dump;
-    dump.done = false;
-    {
-        std::unique_lock<std::mutex> lock(mMutex);
-        if (mDump)
-            return String(); // dump in progress
+    String ret;
+    for (const auto &s : mShards) {
+        Dump dump;
+        dump.done = false;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (s->dump)
+                return String(); // dump in progress
 
-        mDump = &dump;
-        mCondition.notify_one();
-    }
-    std::unique_lock<std::mutex> lock(dump.mutex);
-    while (!dump.done) {
-        dump.cond.wait(lock);
+            s->dump = &dump;
+            s->condition.notify_one();
+        }
+        std::unique_lock<std::mutex> lock(dump.mutex);
+        while (!dump.done) {
+            dump.cond.wait(lock);
+        }
+        ret += dump.string;
     }
-    return std::move(dump.string);
+    return ret;
 }
 
 void CompletionThread::stop()
 {
     std::unique_lock<std::mutex> lock(mMutex);
     mShutdown = true;
-    mCondition.notify_one();
+    for (const auto &s : mShards)
+        s->condition.notify_one();
+}
+
+uint64_t CompletionThread::contextHash(const String &contents, size_t start, size_t prefixLength)
+{
+    start = std::min(start, contents.size());
+    const size_t end = std::min(start + prefixLength, contents.size());
+    uint64_t hash = RTags::fnv1a(contents.constData(), start);
+    hash = RTags::fnv1a(contents.constData() + end, contents.size() - end, hash);
+    // the size without the prefix, it grows as the prefix is typed
+    return hash ^ (contents.size() - (end - start));
+}
+
+size_t CompletionThread::offset(const String &contents, unsigned int line, unsigned int column)
+{
+    size_t pos = 0;
+    while (line > 1) {
+        const size_t newline = contents.indexOf('\n', pos);
+        if (newline == String::npos)
+            return String::npos;
+        pos = newline + 1;
+        --line;
+    }
+    return pos + column - 1;
 }
 
 bool CompletionThread::compareCompletionCandidates(const Completions::Candidate *l,
@@ -178,7 +290,7 @@ bool CompletionThread::compareCompletionCandidates(const Completions::Candidate
     return l->completion < r->completion;
 }
 
-void CompletionThread::process(Request *request)
+void CompletionThread::process(Shard *shard, Request *request)
 {
     ::start = Rct::monoMs();
     LOG() << "processing" << request->toString();
@@ -188,25 +300,33 @@ void CompletionThread::process(Request *request)
     int completeTime = 0;
     int processTime = 0;
     mMutex.lock();
-    SourceFile *&cache = mCacheMap[request->source.fileId];
+    if (request->flags & Speculative && !shard->cacheMap.contains(request->source.fileId)
+        && (shard->cacheMap.size() >= shard->cacheSize
+            || (shard->memoryBudget && shard->memoryUsage >= shard->memoryBudget))) {
+        mMutex.unlock();
+        LOG() << "cache is full, not warming up" << request->source.sourceFile();
+        return;
+    }
+    SourceFile *&cache = shard->cacheMap[request->source.fileId];
 
     if (cache && cache->source != request->source) {
         LOG() << "cached sourcefile doesn't match source, discarding" << request->source.sourceFile();
+        shard->cacheList.remove(cache);
+        shard->memoryUsage -= cache->memoryUsage;
         delete cache;
         cache = 0;
     }
+    bool speculative = false;
     if (!cache) {
+        speculative = request->flags & Speculative;
         cache = new SourceFile;
         LOG() << "creating source file for" << request->source.sourceFile();
-        mCacheList.append(cache);
-        while (mCacheMap.size() > mCacheSize) {
-            SourceFile *c = mCacheList.removeFirst();
-            LOG() << "over cache limit. discarding" << c->source.sourceFile();
-            mCacheMap.remove(c->source.fileId);
-            delete c;
-        }
+        cache->credit = shard->inflation;
+        shard->cacheList.append(cache);
+        evict(shard, cache);
     } else {
-        mCacheList.moveToEnd(cache);
+        cache->credit = shard->inflation + cache->cost();
+        shard->cacheList.moveToEnd(cache);
     }
     mMutex.unlock();
 
@@ -215,6 +335,40 @@ void CompletionThread::process(Request *request)
         cache->source = request->source;
     }
 
+    const Location start(request->location.fileId(), request->location.line(),
+                         request->location.column() - request->prefix.length());
+    uint64_t hash = 0;
+    if (!(request->flags & WarmUp) && !request->unsaved.isEmpty()) {
+        const size_t startOffset = offset(request->unsaved, start.line(), start.column());
+        if (startOffset != String::npos)
+            hash = contextHash(request->unsaved, startOffset, request->prefix.size());
+    }
+    const auto &options = Server::instance()->options();
+    CachedResults &cached = cache->results;
+    if (hash && cache->translationUnit && cached.results
+        && cached.contextHash == hash
+        && cached.start == start
+        && (cached.flags & IncludeMacros) == (request->flags & IncludeMacros)
+        && request->prefix.startsWith(cached.prefix)) {
+        LOG() << "Refiltering" << cached.candidates.size() << "cached completions for" << request->location
+              << cached.prefix << "=>" << request->prefix;
+        List<CompletionCandidate *> candidates(cached.candidates.size());
+        for (size_t i=0; i<cached.candidates.size(); ++i)
+            candidates[i] = &cached.candidates[i];
+        List<std::unique_ptr<MatchResult> > matches = StringTokenizer::find_and_sort_matches(candidates, request->prefix,
+                                                                                            options.maxCompletions);
+        materialise(matches, cached, cached.results);
+        cached.start = start;
+        cached.contextHash = hash;
+        cached.prefix = request->prefix;
+        cached.flags = request->flags;
+        printCompletions(matches, request);
+        ++cache->cachedCompletions;
+        warning("Processed %s from cache, %zu candidates => %zu completions in %dms",
+                request->location.toString().constData(), candidates.size(), matches.size(), sw.elapsed());
+        return;
+    }
+
     const Path sourceFile = request->source.sourceFile();
     CXUnsavedFile unsaved = {
         sourceFile.constData(),
@@ -222,7 +376,6 @@ void CompletionThread::process(Request *request)
         static_cast<unsigned long>(request->unsaved.size())
     };
 
-    const auto &options = Server::instance()->options();
     bool reparse = false;
     if (!cache->translationUnit) {
         if (request->conn && request->flags & NoWait) {
@@ -288,10 +441,13 @@ void CompletionThread::process(Request *request)
         sw.restart();
         assert(cache->translationUnit);
         LOG() << "reparsing translation unit" << request->source.sourceFile();
+        cached.reset();
         cache->translationUnit->reparse(&unsaved, request->unsaved.size() ? 1 : 0);
         reparseTime = cache->reparseTime = sw.elapsed();
         cache->unsaved = std::move(request->unsaved);
     }
+    if (reparse && !updateMemoryUsage(shard, cache, speculative))
+        return;
 
 
     if (request->flags & WarmUp) {
@@ -311,11 +467,8 @@ void CompletionThread::process(Request *request)
     LOG() << "Generated" << (results ? results->NumResults : 0) << "completions for" << request->location << (results ? "successfully" : "unsuccessfully") << "in" << completeTime << "ms";
 
     ++cache->completions;
+    cached.reset();
     if (results) {
-        List<CompletionCandidate *> candidates;
-        candidates.reserve(results->NumResults);
-
-        int nodeCount = 0;
 #ifdef RTAGS_COMPLETION_TOKENS_ENABLED
         Map<Token, int> tokens;
         if (!request->unsaved.isEmpty()) {
@@ -325,8 +478,11 @@ void CompletionThread::process(Request *request)
             // }
         }
 #endif
+        // Only the typed text is needed to filter and rank, the rest is
+        // filled in for the candidates we end up sending
+        cached.candidates.reserve(results->NumResults);
+        cached.indexes.reserve(results->NumResults);
         for (unsigned int i = 0; i < results->NumResults; ++i) {
-            const CXCursorKind kind = results->Results[i].CursorKind;
             const CXCompletionString &string = results->Results[i].CompletionString;
 
             const CXAvailabilityKind availabilityKind = clang_getCompletionAvailability(string);
@@ -343,58 +499,45 @@ void CompletionThread::process(Request *request)
                 }
             }
 
-            const int priority = clang_getCompletionPriority(string);
-
-            CompletionCandidate *candidate = new CompletionCandidate;
-            candidate->kind = RTags::eatString(clang_getCursorKindSpelling(kind));
-            candidate->priority = priority;
-            candidate->parent = RTags::eatString(clang_getCompletionParent(string, 0));
-            candidate->brief_comment = RTags::eatString(clang_getCompletionBriefComment(string));
-
-            candidates.push_back(candidate);
-
-            bool ok = true;
             const int chunkCount = clang_getNumCompletionChunks(string);
             for (int j=0; j<chunkCount; ++j) {
-                const CXCompletionChunkKind chunkKind = clang_getCompletionChunkKind(string, j);
-                String text = RTags::eatString(clang_getCompletionChunkText(string, j));
-                if (chunkKind == CXCompletionChunk_TypedText) {
-                    candidate->name = text;
-                    if (candidate->name.isEmpty()) {
-                        ok = false;
-                        break;
-                    }
-                    candidate->signature += candidate->name;
-                } else {
-                    candidate->signature += text;
-                    if (chunkKind == CXCompletionChunk_ResultType)
-                        candidate->signature += ' ';
-                }
-            }
-
-            if (ok) {
-                const unsigned int annotations = clang_getCompletionNumAnnotations(string);
-                for (unsigned j=0; j<annotations; ++j) {
-                    const CXStringScope annotation = clang_getCompletionAnnotation(string, j);
-                    const char *cstr = clang_getCString(annotation);
-                    if (strlen(cstr)) {
-                        if (!candidate->annotation.isEmpty())
-                            candidate->annotation += ' ';
-                        candidate->annotation + cstr;
+                if (clang_getCompletionChunkKind(string, j) == CXCompletionChunk_TypedText) {
+                    String name = RTags::eatString(clang_getCompletionChunkText(string, j));
+                    if (!name.isEmpty()) {
+                        cached.candidates.append(CompletionCandidate());
+                        CompletionCandidate &candidate = cached.candidates.back();
+                        candidate.name = std::move(name);
+                        candidate.priority = clang_getCompletionPriority(string);
+                        cached.indexes.append(i);
                     }
+                    break;
                 }
             }
         }
-
-        List<std::unique_ptr<MatchResult> > matches = StringTokenizer::find_and_sort_matches(candidates, request->prefix);
+        const int typedTextTime = sw.restart();
+
+        List<CompletionCandidate *> candidates(cached.candidates.size());
+        for (size_t i=0; i<cached.candidates.size(); ++i)
+            candidates[i] = &cached.candidates[i];
+        List<std::unique_ptr<MatchResult> > matches = StringTokenizer::find_and_sort_matches(candidates, request->prefix,
+                                                                                            options.maxCompletions);
+        const int filterTime = sw.restart();
+        materialise(matches, cached, results);
+        const int materialiseTime = sw.restart();
+        cached.results = results;
+        cached.start = start;
+        cached.contextHash = hash;
+        cached.prefix = request->prefix;
+        cached.flags = request->flags;
 
         if (!matches.isEmpty()) {
             printCompletions(matches, request);
-            processTime = sw.elapsed();
+            processTime = typedTextTime + filterTime + materialiseTime + sw.elapsed();
             LOG() << "Sent" << matches.size() << "completions for" << request->location;
-            warning("Processed %s, parse %d/%d, complete %d, process %d => %d completions (unsaved %zu)",
+            warning("Processed %s, parse %d/%d, complete %d, process %d (typed text %d, filter %d, materialise %d) => %zu/%zu completions (unsaved %zu)",
                     request->location.toString().constData(),
-                    parseTime, reparseTime, completeTime, processTime, nodeCount, request->unsaved.size());
+                    parseTime, reparseTime, completeTime, processTime, typedTextTime, filterTime, materialiseTime,
+                    matches.size(), cached.candidates.size(), request->unsaved.size());
 
         } else {
             LOG() << "No completions available for" << request->location;
@@ -403,7 +546,94 @@ void CompletionThread::process(Request *request)
         }
 
         processDiagnostics(request, results, cache->translationUnit->unit);
-        clang_disposeCodeCompleteResults(results);
+    }
+}
+
+bool CompletionThread::updateMemoryUsage(Shard *shard, SourceFile *cache, bool speculative)
+{
+    size_t memoryUsage = 0;
+    CXTUResourceUsage usage = clang_getCXTUResourceUsage(cache->translationUnit->unit);
+    for (unsigned int i=0; i<usage.numEntries; ++i)
+        memoryUsage += usage.entries[i].amount;
+    clang_disposeCXTUResourceUsage(usage);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    shard->memoryUsage = shard->memoryUsage - cache->memoryUsage + memoryUsage;
+    cache->memoryUsage = memoryUsage;
+    cache->credit = shard->inflation + cache->cost();
+    if (speculative && shard->memoryBudget && shard->memoryUsage > shard->memoryBudget) {
+        // a guess never pushes out a unit that is in use
+        LOG() << "speculative unit doesn't fit, discarding" << cache->source.sourceFile()
+              << String::format<64>("%.1fMB", cache->memoryUsage / (1024.0 * 1024.0));
+        shard->cacheList.remove(cache);
+        shard->cacheMap.remove(cache->source.fileId);
+        shard->memoryUsage -= cache->memoryUsage;
+        delete cache;
+        return false;
+    }
+    evict(shard, cache);
+    return true;
+}
+
+// mMutex must be held
+void CompletionThread::evict(Shard *shard, SourceFile *keep)
+{
+    while (shard->cacheMap.size() > shard->cacheSize
+           || (shard->memoryBudget && shard->memoryUsage > shard->memoryBudget)) {
+        // cacheList is in lru order so ties go to the least recently used one
+        SourceFile *victim = 0;
+        for (SourceFile *c = shard->cacheList.first(); c; c = c->next) {
+            if (c != keep && (!victim || c->credit < victim->credit))
+                victim = c;
+        }
+        if (!victim)
+            break;
+        LOG() << "over cache limit. discarding" << victim->source.sourceFile()
+              << String::format<64>("%.1fMB", victim->memoryUsage / (1024.0 * 1024.0))
+              << "parseTime" << victim->parseTime;
+        shard->inflation = victim->credit;
+        shard->cacheList.remove(victim);
+        shard->cacheMap.remove(victim->source.fileId);
+        shard->memoryUsage -= victim->memoryUsage;
+        delete victim;
+    }
+}
+
+void CompletionThread::materialise(const List<std::unique_ptr<MatchResult> > &matches,
+                                   CachedResults &cached, CXCodeCompleteResults *results)
+{
+    for (const std::unique_ptr<MatchResult> &match : matches) {
+        CompletionCandidate *candidate = match->candidate;
+        if (!candidate->kind.isEmpty())
+            continue; // sent before, when the prefix was shorter
+        const CXCompletionResult &result = results->Results[cached.indexes.at(candidate - cached.candidates.data())];
+        const CXCompletionString &string = result.CompletionString;
+        candidate->kind = RTags::eatString(clang_getCursorKindSpelling(result.CursorKind));
+        candidate->parent = RTags::eatString(clang_getCompletionParent(string, 0));
+        candidate->brief_comment = RTags::eatString(clang_getCompletionBriefComment(string));
+
+        const int chunkCount = clang_getNumCompletionChunks(string);
+        for (int j=0; j<chunkCount; ++j) {
+            const CXCompletionChunkKind chunkKind = clang_getCompletionChunkKind(string, j);
+            if (chunkKind == CXCompletionChunk_TypedText) {
+                candidate->signature += candidate->name;
+            } else {
+                candidate->signature += RTags::eatString(clang_getCompletionChunkText(string, j));
+                if (chunkKind == CXCompletionChunk_ResultType)
+                    candidate->signature += ' ';
+            }
+        }
+
+        const unsigned int annotations = clang_getCompletionNumAnnotations(string);
+        for (unsigned j=0; j<annotations; ++j) {
+            const CXStringScope annotation = clang_getCompletionAnnotation(string, j);
+            const char *cstr = clang_getCString(annotation);
+            if (strlen(cstr)) {
+                if (!candidate->annotation.isEmpty())
+                    candidate->annotation += ' ';
+                candidate->annotation += cstr;
+            }
+        }
     }
 }
 
@@ -605,9 +835,11 @@ void CompletionThread::printCompletions(const List<std::unique_ptr<MatchResult>
 bool CompletionThread::isCached(uint32_t fileId, const std::shared_ptr<Project> &project) const
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    for (SourceFile *file : mCacheList) {
-        if (file->source.fileId == fileId || project->dependsOn(file->source.fileId, fileId))
-            return true;
+    for (const auto &s : mShards) {
+        for (SourceFile *file : s->cacheList) {
+            if (file->source.fileId == fileId || project->dependsOn(file->source.fileId, fileId))
+                return true;
+        }
     }
     return false;
 }
@@ -629,6 +861,7 @@ String CompletionThread::Request::toString() const
         { "JSON", JSON },
         { "IncludeMacros", IncludeMacros },
         { "WarmUp", WarmUp },
+        { "Speculative", Speculative },
     };
 
     for (const auto &flag : f) {
@@ -667,9 +900,11 @@ String CompletionThread::Request::toString() const
 Source CompletionThread::findSource(const Set<uint32_t> &deps) const
 {
     std::unique_lock<std::mutex> lock(mMutex);
-    for (SourceFile *sourceFile = mCacheList.first(); sourceFile; sourceFile = sourceFile->next) {
-        if (deps.contains(sourceFile->source.fileId)) {
-            return sourceFile->source;
+    for (const auto &s : mShards) {
+        for (SourceFile *sourceFile = s->cacheList.first(); sourceFile; sourceFile = sourceFile->next) {
+            if (deps.contains(sourceFile->source.fileId)) {
+                return sourceFile->source;
+            }
         }
     }
     return Source();
@@ -743,5 +978,10 @@ void CompletionThread::processDiagnostics(const Request *request, CXCodeComplete
     CompletionDiagnostics diag(sourceFileId, request->location.fileId(), results, unit);
     diag.diagnose();
     // error() << "got diagnostics" << diag.indexDataMessage().diagnostics().size();
-    project->updateDiagnostics(sourceFileId, diag.indexDataMessage().diagnostics());
+    // several workers can get here at the same time, the project is only
+    // touched on the main thread
+    const Diagnostics diagnostics = diag.indexDataMessage().diagnostics();
+    EventLoop::mainEventLoop()->callLater([project, sourceFileId, diagnostics]() {
+            project->updateDiagnostics(sourceFileId, diagnostics);
+        });
 }
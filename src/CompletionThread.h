@@ -30,12 +30,17 @@
 #include "rct/Thread.h"
 #include "Source.h"
 #include "RTags.h"
+#include "StringTokenizer.h"
 
-struct MatchResult;
+// Runs the completion workers. This thread is the first one and starts the
+// rest from run(). Every source file belongs to one worker (by fileId) which
+// owns its cached translation units, so completions for different files are
+// handled in parallel while requests for the same file stay in order.
 class CompletionThread : public Thread
 {
 public:
-    CompletionThread(int cacheSize);
+    // cacheMemory is in bytes, 0 means only cacheSize limits the cache
+    CompletionThread(int cacheSize, int workerCount = 1, size_t cacheMemory = 0);
     ~CompletionThread();
 
     virtual void run() override;
@@ -46,24 +51,42 @@ public:
         JSON = 0x04,
         IncludeMacros = 0x08,
         WarmUp = 0x10,
-        NoWait = 0x20
+        NoWait = 0x20,
+        Speculative = 0x40
     };
     bool isCached(uint32_t fileId, const std::shared_ptr<Project> &project) const;
     void completeAt(Source &&source, Location location, Flags<Flag> flags,
                     String &&unsaved, const String &prefix,
                     const std::shared_ptr<Connection> &conn);
     void prepare(Source &&source, String &&unsaved);
+    // Warms up a unit rdm expects to be asked for soon. These only run when
+    // the worker has nothing else to do and never evict a cached unit.
+    void prepareSpeculatively(Source &&source, String &&unsaved);
     Source findSource(const Set<uint32_t> &deps) const;
     void stop();
     String dump();
+
+    // Hash of the buffer without the identifier being completed, start is
+    // the offset where the completion starts. Requests with the same hash
+    // only differ in how much of the identifier is typed, so the results
+    // of the first one can be refiltered for the others.
+    static uint64_t contextHash(const String &contents, size_t start, size_t prefixLength);
+    // Offset of the 1-based line and column in contents
+    static size_t offset(const String &contents, unsigned int line, unsigned int column);
 private:
     struct Request;
+    struct Shard;
+    class Worker;
+    void loop(Shard *shard);
     void processDiagnostics(const Request *request, CXCodeCompleteResults *results, CXTranslationUnit unit);
-    void process(Request *request);
+    void process(Shard *shard, Request *request);
+    // Returns false if cache was a speculative unit that didn't fit and is gone
+    bool updateMemoryUsage(Shard *shard, SourceFile *cache, bool speculative);
+    void evict(Shard *shard, SourceFile *keep);
 
     Set<uint32_t> mWatched;
     bool mShutdown;
-    const size_t mCacheSize;
+    const size_t mCacheSize, mCacheMemory;
     struct Request {
         ~Request()
         {
@@ -77,13 +100,12 @@ private:
         String unsaved, prefix;
         std::shared_ptr<Connection> conn;
     };
-    LinkedList<Request*> mPending;
     struct Dump {
         bool done;
         std::mutex mutex;
         std::condition_variable cond;
         String string;
-    } *mDump;
+    };
 
     struct Completions {
         Completions(Location loc) : location(loc), next(0), prev(0) {}
@@ -123,15 +145,65 @@ private:
     static bool compareCompletionCandidates(const Completions::Candidate *l,
                                             const Completions::Candidate *r);
 
+    // The candidates of the last clang_codeCompleteAt. As long as the user
+    // keeps typing the same identifier the completion starts at the same
+    // place and nothing outside the identifier changed, so we can filter
+    // these again instead of asking clang. The candidates only have their
+    // name and priority until they are sent, materialise() fills in the rest
+    // from results->Results[indexes[i]].
+    struct CachedResults {
+        CachedResults()
+            : contextHash(0), flags(None), results(0)
+        {}
+        ~CachedResults() { reset(); }
+
+        void reset()
+        {
+            contextHash = 0;
+            candidates.clear();
+            indexes.clear();
+            if (results) {
+                clang_disposeCodeCompleteResults(results);
+                results = 0;
+            }
+        }
+
+        Location start;
+        uint64_t contextHash;
+        String prefix;
+        Flags<Flag> flags;
+        CXCodeCompleteResults *results;
+        List<CompletionCandidate> candidates;
+        List<unsigned int> indexes;
+    private:
+        CachedResults(const CachedResults &) = delete;
+        CachedResults &operator=(const CachedResults &) = delete;
+    };
+
+    static void materialise(const List<std::unique_ptr<MatchResult> > &matches, CachedResults &cached,
+                            CXCodeCompleteResults *results);
+
     struct SourceFile {
         SourceFile()
-            : lastModified(0), parseTime(0), reparseTime(0), codeCompleteTime(0), completions(0), next(0), prev(0)
+            : lastModified(0), parseTime(0), reparseTime(0), codeCompleteTime(0), completions(0), cachedCompletions(0),
+              memoryUsage(0), credit(0), next(0), prev(0)
         {}
+
+        // What it costs to parse this unit again per MB it holds on to
+        double cost() const
+        {
+            return std::max<uint64_t>(parseTime, 1) / std::max(memoryUsage / (1024.0 * 1024.0), 1.0);
+        }
         std::shared_ptr<RTags::TranslationUnit> translationUnit;
         String unsaved;
         uint64_t lastModified;
         uint64_t parseTime, reparseTime, codeCompleteTime; // ms
-        size_t completions;
+        size_t completions, cachedCompletions;
+        size_t memoryUsage; // bytes, from clang_getCXTUResourceUsage
+        // Greedy dual size: the shard's inflation when this was last used
+        // plus cost(), the lowest one is evicted first
+        double credit;
+        CachedResults results;
         Source source;
         SourceFile *next, *prev;
     };
@@ -195,11 +267,32 @@ private:
     };
 #endif
 
-    Hash<uint32_t, SourceFile*> mCacheMap;
-    EmbeddedLinkedList<SourceFile*> mCacheList;
+    struct Shard {
+        Shard(size_t idx, size_t size, size_t memory)
+            : index(idx), cacheSize(size), memoryBudget(memory), memoryUsage(0), inflation(0), dump(0)
+        {}
+        ~Shard() { cacheList.deleteAll(); }
+
+        const size_t index, cacheSize, memoryBudget;
+        size_t memoryUsage;
+        // credit of the last unit evicted, so units that haven't been used
+        // for a while lose out to ones that just were
+        double inflation;
+        // interactive requests go in front, warm-ups at the back
+        LinkedList<Request*> pending;
+        // speculative warm-ups, only looked at when pending is empty
+        LinkedList<Request*> idle;
+        Dump *dump;
+        Hash<uint32_t, SourceFile*> cacheMap;
+        EmbeddedLinkedList<SourceFile*> cacheList;
+        std::condition_variable condition;
+    };
+    Shard *shard(uint32_t fileId) const { return mShards[fileId % mShards.size()].get(); }
+    List<std::unique_ptr<Shard> > mShards;
 
+    // protects everything in the shards except the SourceFiles' contents,
+    // those are only touched by the worker that owns them
     mutable std::mutex mMutex;
-    std::condition_variable mCondition;
 };
 
 RCT_FLAGS(CompletionThread::Flag);
@@ -21,8 +21,10 @@
 #include <sys/file.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <functional>
 #include <limits>
+#include <memory>
 
 #include "Location.h"
 #include "rct/Serializer.h"
@@ -74,6 +76,13 @@ public:
         memcpy(&mValuesOffset, mPointer + sizeof(uint32_t), sizeof(uint32_t));
     }
 
+    // For maps that live inside a larger mapping that someone else owns
+    void init(const char *pointer, uint32_t size, const std::shared_ptr<const void> &owner)
+    {
+        mOwner = owner;
+        init(pointer, size);
+    }
+
     enum Options {
         None = 0x0,
         NoLock = 0x1
@@ -189,53 +198,44 @@ public:
         return lower;
     }
 
-    static String encode(const Map<Key, Value> &map)
+    // Index of the first key greater than k, count() if there is none
+    uint32_t upperBound(const Key &k) const
     {
-        String out;
-        Serializer serializer(out);
-        serializer << static_cast<uint32_t>(map.size());
-        uint32_t valuesOffset;
-        if (uint32_t size = FixedSize<Key>::value) {
-            valuesOffset = ((static_cast<uint32_t>(map.size()) * size) + (sizeof(uint32_t) * 2));
-            serializer << valuesOffset;
-            for (const std::pair<Key, Value> &pair : map) {
-                out.append(reinterpret_cast<const char*>(&pair.first), size);
-            }
-        } else {
-            serializer << static_cast<uint32_t>(0); // values offset
-            uint32_t offset = sizeof(uint32_t) * 2 + (map.size() * sizeof(uint32_t));
-            String keyData;
-            Serializer keySerializer(keyData);
-            for (const std::pair<Key, Value> &pair : map) {
-                const uint32_t pos = offset + keyData.size();
-                out.append(reinterpret_cast<const char*>(&pos), sizeof(pos));
-                keySerializer << pair.first;
-            }
-            out.append(keyData);
-            valuesOffset = out.size();
-            memcpy(out.data() + sizeof(uint32_t), &valuesOffset, sizeof(valuesOffset));
-        }
-        assert(valuesOffset == static_cast<uint32_t>(out.size()));
+        bool match;
+        const uint32_t idx = lowerBound(k, &match);
+        if (idx == std::numeric_limits<uint32_t>::max())
+            return mCount;
+        return match ? idx + 1 : idx;
+    }
 
-        if (uint32_t size = FixedSize<Value>::value) {
-            for (const std::pair<Key, Value> &pair : map) {
-                out.append(reinterpret_cast<const char*>(&pair.second), size);
-            }
-        } else {
-            const uint32_t encodedValuesOffset = valuesOffset + (sizeof(uint32_t) * map.size());
-            String valueData;
-            Serializer valueSerializer(valueData);
-            for (const std::pair<Key, Value> &pair : map) {
-                const uint32_t pos = encodedValuesOffset + valueData.size();
-                out.append(reinterpret_cast<const char*>(&pos), sizeof(pos));
-                valueSerializer << pair.second;
-            }
-            out.append(valueData);
+    // The indexes of the keys in [from, to], for walking a stretch of the
+    // map in order with keyAt/valueAt instead of looking up each key.
+    struct Range {
+        uint32_t begin, end;
 
-        }
+        bool isEmpty() const { return begin >= end; }
+        uint32_t size() const { return isEmpty() ? 0 : end - begin; }
+    };
+
+    Range range(const Key &from, const Key &to) const
+    {
+        Range ret = { std::min(lowerBound(from), mCount), upperBound(to) };
+        if (ret.end < ret.begin)
+            ret.end = ret.begin;
+        return ret;
+    }
+
+    // Anything that iterates sorted, unique (Key, Value) pairs
+    template <typename Container>
+    static String encode(const Container &map)
+    {
+        String out;
+        StringSink sink(out);
+        encode(map, sink);
         return out;
     }
-    static size_t write(const Path &path, const Map<Key, Value> &map, uint32_t options)
+    template <typename Container>
+    static size_t write(const Path &path, const Container &map, uint32_t options)
     {
         int fd = open(path.constData(), O_RDWR|O_CREAT, 0644);
         if (fd == -1) {
@@ -249,23 +249,16 @@ public:
             ::close(fd);
             return 0;
         }
-        const String data = encode(map);
-        bool ok = ::ftruncate(fd, data.size()) != -1;
-        if (!ok) {
-            if (!(options & NoLock))
-                lock(fd, Unlock);
-            ::close(fd);
-            return 0;
-        }
-
-        ok = ::write(fd, data.constData(), data.size()) == static_cast<ssize_t>(data.size());
+        FileSink sink(fd);
+        const size_t size = encode(map, sink);
+        bool ok = size && sink.flush();
         if (!(options & NoLock))
             ok = lock(fd, Unlock) && ok;
 
         ::close(fd);
         if (!ok)
             unlink(path.constData());
-        return ok ? data.size() : 0;
+        return ok ? size : 0;
     }
 private:
     enum Mode {
@@ -284,6 +277,147 @@ private:
         eintrwrap(ret, fcntl(fd, F_SETLKW, &fl));
         return ret != -1;
     }
+    // The offset tables are computed in a first pass so keys and values can
+    // be serialized straight into the sink in file order, one at a time.
+    template <typename Container, typename Sink>
+    static size_t encode(const Container &map, Sink &sink)
+    {
+        const uint32_t count = map.size();
+        const uint32_t keySize = FixedSize<Key>::value;
+        const uint32_t valueSize = FixedSize<Value>::value;
+        List<uint32_t> keySizes, valueSizes;
+        String scratch;
+        uint32_t keyBytes = count * keySize, valueBytes = count * valueSize;
+        if (!keySize || !valueSize) {
+            if (!keySize)
+                keySizes.reserve(count);
+            if (!valueSize)
+                valueSizes.reserve(count);
+            for (const auto &pair : map) {
+                if (!keySize) {
+                    keySizes.append(serialize(pair.first, scratch));
+                    keyBytes += sizeof(uint32_t) + keySizes.back();
+                }
+                if (!valueSize) {
+                    valueSizes.append(serialize(pair.second, scratch));
+                    valueBytes += sizeof(uint32_t) + valueSizes.back();
+                }
+            }
+        }
+        const uint32_t valuesOffset = (sizeof(uint32_t) * 2) + keyBytes;
+        const size_t size = valuesOffset + valueBytes;
+        if (!sink.reserve(size))
+            return 0;
+        sink.write(&count, sizeof(count));
+        sink.write(&valuesOffset, sizeof(valuesOffset));
+        if (keySize) {
+            for (const auto &pair : map)
+                sink.write(&pair.first, keySize);
+        } else {
+            writeOffsets(sink, sizeof(uint32_t) * 2, keySizes);
+            for (const auto &pair : map) {
+                serialize(pair.first, scratch);
+                sink.write(scratch.constData(), scratch.size());
+            }
+        }
+        if (valueSize) {
+            for (const auto &pair : map)
+                sink.write(&pair.second, valueSize);
+        } else {
+            writeOffsets(sink, valuesOffset, valueSizes);
+            for (const auto &pair : map) {
+                serialize(pair.second, scratch);
+                sink.write(scratch.constData(), scratch.size());
+            }
+        }
+        return sink.ok() ? size : 0;
+    }
+
+    template <typename Sink>
+    static void writeOffsets(Sink &sink, uint32_t offset, const List<uint32_t> &sizes)
+    {
+        uint32_t pos = offset + (sizeof(uint32_t) * sizes.size());
+        for (uint32_t size : sizes) {
+            sink.write(&pos, sizeof(pos));
+            pos += size;
+        }
+    }
+
+    template <typename T>
+    static uint32_t serialize(const T &t, String &scratch)
+    {
+        scratch.clear();
+        Serializer serializer(scratch);
+        serializer << t;
+        return scratch.size();
+    }
+
+    struct StringSink
+    {
+        StringSink(String &o)
+            : out(o)
+        {}
+        bool reserve(size_t size) { out.reserve(size); return true; }
+        void write(const void *data, size_t size) { out.append(static_cast<const char*>(data), size); }
+        bool ok() const { return true; }
+
+        String &out;
+    };
+
+    // Writes through a bounded buffer so we never hold a copy of the
+    // whole file.
+    struct FileSink
+    {
+        enum { BufferSize = 1024 * 1024 };
+        FileSink(int f)
+            : fd(f), error(false)
+        {}
+        bool reserve(size_t size)
+        {
+            // drop whatever was there and set the final size, this makes a
+            // sparse file, blocks are only allocated as we write them
+            error = ::ftruncate(fd, 0) == -1 || ::ftruncate(fd, size) == -1;
+            buffer.reserve(std::min<size_t>(size, BufferSize));
+            return !error;
+        }
+        void write(const void *data, size_t size)
+        {
+            if (buffer.size() + size > BufferSize && !flush())
+                return;
+            if (size >= BufferSize) {
+                writeAll(static_cast<const char*>(data), size);
+            } else {
+                buffer.append(static_cast<const char*>(data), size);
+            }
+        }
+        bool flush()
+        {
+            if (!buffer.isEmpty()) {
+                writeAll(buffer.constData(), buffer.size());
+                buffer.clear();
+            }
+            return !error;
+        }
+        void writeAll(const char *data, size_t size)
+        {
+            while (size && !error) {
+                ssize_t w;
+                eintrwrap(w, ::write(fd, data, size));
+                if (w <= 0) {
+                    error = true;
+                } else {
+                    data += w;
+                    size -= w;
+                }
+            }
+        }
+        bool ok() const { return !error; }
+
+        const int fd;
+        String buffer;
+        bool error;
+    };
+
     const char *valuesSegment() const { return mPointer + mValuesOffset; }
     const char *keysSegment() const { return mPointer + (sizeof(uint32_t) * 2); }
 
@@ -309,6 +443,7 @@ private:
     uint32_t mValuesOffset;
     int mFD;
     uint32_t mOptions;
+    std::shared_ptr<const void> mOwner;
 };
 
 #endif
@@ -16,12 +16,16 @@
 #ifndef IndexDataMessage_h
 #define IndexDataMessage_h
 
+#include <unistd.h>
+
 #include "Diagnostic.h"
 #include "IndexerJob.h"
 #include "rct/Flags.h"
+#include "rct/Log.h"
 #include "rct/Serializer.h"
 #include "rct/String.h"
 #include "RTagsMessage.h"
+#include "SharedMemory.h"
 
 class IndexDataMessage : public RTagsMessage
 {
@@ -29,11 +33,11 @@ public:
     enum { MessageId = IndexDataMessageId };
 
     IndexDataMessage(const std::shared_ptr<IndexerJob> &job)
-        : RTagsMessage(MessageId), mParseTime(0), mId(0), mIndexerJobFlags(job->flags), mBytesWritten(0)
+        : RTagsMessage(MessageId), mParseTime(0), mId(0), mIndexerJobFlags(job->flags), mBytesWritten(0), mPeakMemory(0), mSharedSize(0)
     {}
 
     IndexDataMessage()
-        : RTagsMessage(MessageId), mParseTime(0), mId(0), mBytesWritten(0)
+        : RTagsMessage(MessageId), mParseTime(0), mId(0), mBytesWritten(0), mPeakMemory(0), mSharedSize(0)
     {}
 
     void encode(Serializer &serializer) const;
@@ -98,7 +102,20 @@ public:
 
     size_t bytesWritten() const { return mBytesWritten; }
     void setBytesWritten(size_t bytes) { mBytesWritten = bytes; }
+
+    uint64_t peakMemory() const { return mPeakMemory; }
+    void setPeakMemory(uint64_t bytes) { mPeakMemory = bytes; }
+
+    // Called by rp before sending. If the payload is large it's moved to a
+    // shared memory object and only its name goes through the socket, rdm
+    // unlinks it after decoding. Call unshare() if the message never made it.
+    bool share(String *error = 0);
+    void unshare();
+    const String &sharedName() const { return mSharedName; }
 private:
+    void encodePayload(Serializer &serializer) const;
+    void decodePayload(Deserializer &deserializer);
+
     Path mProject;
     uint64_t mParseTime, mId;
     Flags<IndexerJob::Flag> mIndexerJobFlags; // indexerjobflags
@@ -109,21 +126,80 @@ private:
     Hash<uint32_t, Flags<FileFlag> > mFiles;
     Flags<Flag> mFlags;
     size_t mBytesWritten;
+    uint64_t mPeakMemory;
+    String mSharedName;
+    uint64_t mSharedSize;
 };
 
 RCT_FLAGS(IndexDataMessage::Flag);
 RCT_FLAGS(IndexDataMessage::FileFlag);
 
+inline void IndexDataMessage::encodePayload(Serializer &serializer) const
+{
+    serializer << mMessage << mFixIts << mIncludes << mDiagnostics << mFiles << mFlags << mBytesWritten << mPeakMemory;
+}
+
+inline void IndexDataMessage::decodePayload(Deserializer &deserializer)
+{
+    deserializer >> mMessage >> mFixIts >> mIncludes >> mDiagnostics >> mFiles >> mFlags >> mBytesWritten >> mPeakMemory;
+}
+
 inline void IndexDataMessage::encode(Serializer &serializer) const
 {
-    serializer << mProject << mParseTime << mId << mIndexerJobFlags << mMessage
-               << mFixIts << mIncludes << mDiagnostics << mFiles << mFlags << mBytesWritten;
+    serializer << mProject << mParseTime << mId << mIndexerJobFlags << mSharedName;
+    if (mSharedName.isEmpty()) {
+        encodePayload(serializer);
+    } else {
+        serializer << mSharedSize;
+    }
 }
 
 inline void IndexDataMessage::decode(Deserializer &deserializer)
 {
-    deserializer >> mProject >> mParseTime >> mId >> mIndexerJobFlags >> mMessage
-                 >> mFixIts >> mIncludes >> mDiagnostics >> mFiles >> mFlags >> mBytesWritten;
+    deserializer >> mProject >> mParseTime >> mId >> mIndexerJobFlags >> mSharedName;
+    if (mSharedName.isEmpty()) {
+        decodePayload(deserializer);
+        return;
+    }
+    deserializer >> mSharedSize;
+    SharedMemory::Mapping mapping;
+    String err;
+    if (mapping.map(mSharedName, mSharedSize, &err)) {
+        Deserializer payload(mapping.data(), mapping.size());
+        decodePayload(payload);
+    } else {
+        error() << "Failed to read IndexDataMessage for" << mId << err;
+        mFlags |= ParseFailure;
+    }
+    unshare();
+}
+
+inline bool IndexDataMessage::share(String *error)
+{
+    assert(mSharedName.isEmpty());
+    String payload;
+    {
+        Serializer serializer(payload);
+        encodePayload(serializer);
+    }
+    if (payload.size() < SharedMemory::Threshold)
+        return false;
+    const String name = String::format<64>("/rtp%x-%llx", static_cast<unsigned int>(getpid()),
+                                           static_cast<unsigned long long>(mId));
+    if (!SharedMemory::write(name, payload.constData(), payload.size(), error))
+        return false;
+    mSharedName = name;
+    mSharedSize = payload.size();
+    return true;
+}
+
+inline void IndexDataMessage::unshare()
+{
+    if (!mSharedName.isEmpty()) {
+        SharedMemory::unlink(mSharedName);
+        mSharedName.clear();
+        mSharedSize = 0;
+    }
 }
 
 #endif
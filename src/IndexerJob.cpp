@@ -186,9 +186,10 @@ String IndexerJob::encode() const
                    << static_cast<uint32_t>(options.rpConnectTimeout)
                    << static_cast<uint32_t>(options.rpConnectAttempts)
                    << static_cast<int32_t>(options.rpNiceValue)
-                   << options.options
-                   << unsavedFiles
-                   << options.dataDir
+                   << options.options;
+        mSharedBuffers.clear();
+        SharedMemory::encodeUnsavedFiles(serializer, unsavedFiles, mSharedBuffers);
+        serializer << options.dataDir
                    << options.debugLocations;
 
         proj->encodeVisitedFiles(serializer);
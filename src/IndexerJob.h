@@ -19,6 +19,7 @@
 #include "rct/Flags.h"
 #include "rct/SignalSlot.h"
 #include "RTags.h"
+#include "SharedMemory.h"
 #include "Source.h"
 
 class IndexerJob
@@ -65,6 +66,8 @@ public:
     Signal<std::function<void(IndexerJob *)> > destroyed;
 
 private:
+    // unsaved buffers published for rp, alive as long as the job
+    mutable List<std::shared_ptr<SharedMemory::Segment> > mSharedBuffers;
     mutable int mCachedPriority;
     static uint64_t sNextId;
 };
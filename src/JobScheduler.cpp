@@ -15,46 +15,56 @@
 
 #include "JobScheduler.h"
 
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
 #include "IndexDataMessage.h"
 #include "IndexerJob.h"
 #include "Project.h"
 #include "rct/Connection.h"
+#include "rct/DataFile.h"
 #include "rct/Process.h"
 #include "Server.h"
 
 enum { MaxPriority = 10 };
 // we set the priority to be this when a job has been requested and we couldn't load it
 JobScheduler::JobScheduler()
-    : mProcrastination(0)
-{}
+    : mProcrastination(0), mSequence(0), mTotalCostDuration(0), mTotalCostPeakMemory(0), mCostsDirty(false),
+      mLastLoadSample(0), mTargetJobCount(0), mDeferredJobs(0), mDeferTimer(-1), mMemoryHeadroom(UINT64_MAX),
+      mResidentProcess(0), mResidentBusy(false)
+{
+    loadCosts();
+}
 
 JobScheduler::~JobScheduler()
 {
-    mPendingJobs.deleteAll();
+    if (mDeferTimer >= 0)
+        EventLoop::eventLoop()->unregisterTimer(mDeferTimer);
+    saveCosts();
+    mPendingJobs.clear();
     if (!mActiveByProcess.isEmpty()) {
         for (const auto &job : mActiveByProcess) {
+            if (job.first == mResidentProcess)
+                continue;
             job.first->kill();
             delete job.first;
         }
     }
+    if (mResidentProcess) {
+        mResidentProcess->kill();
+        delete mResidentProcess;
+    }
 }
 
 void JobScheduler::add(const std::shared_ptr<IndexerJob> &job)
 {
     assert(!(job->flags & ~IndexerJob::Type_Mask));
-    std::shared_ptr<Node> node(new Node({ 0, job, 0, 0, 0, String() }));
-    node->job = job;
+    std::shared_ptr<Node> node(new Node({ 0, job, 0, ++mSequence, predictedDuration(job->fileId()), coverage(job), String() }));
     // error() << job->priority << job->sourceFile << mProcrastination;
-    if (mPendingJobs.isEmpty() || job->priority() > mPendingJobs.first()->job->priority()) {
-        mPendingJobs.prepend(node);
-    } else {
-        std::shared_ptr<Node> after = mPendingJobs.last();
-        while (job->priority() > after->job->priority()) {
-            after = after->prev;
-            assert(after);
-        }
-        mPendingJobs.insert(node, after);
-    }
+    mPendingJobs.push_back(node);
+    std::push_heap(mPendingJobs.begin(), mPendingJobs.end(), &JobScheduler::lessUrgent);
     assert(!mInactiveById.contains(job->id));
     mInactiveById[job->id] = node;
     // error() << "procrash" << mProcrastination << job->sourceFile;
@@ -62,6 +72,204 @@ void JobScheduler::add(const std::shared_ptr<IndexerJob> &job)
         startJobs();
 }
 
+bool JobScheduler::lessUrgent(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r)
+{
+    const int lp = l->job->priority();
+    const int rp = r->job->priority();
+    if (lp != rp)
+        return lp < rp;
+    if (l->coverage != r->coverage)
+        return l->coverage < r->coverage;
+    // longest processing time first keeps the tail of a full index short
+    if (l->predicted != r->predicted)
+        return l->predicted < r->predicted;
+    return l->sequence > r->sequence;
+}
+
+std::shared_ptr<JobScheduler::Node> JobScheduler::takeFirst(Set<uint32_t> *claimed)
+{
+    assert(!mPendingJobs.empty());
+    const bool headerCoverage = Server::instance()->options().options & Server::HeaderCoverageScheduling;
+    while (true) {
+        std::pop_heap(mPendingJobs.begin(), mPendingJobs.end(), &JobScheduler::lessUrgent);
+        std::shared_ptr<Node> ret = std::move(mPendingJobs.back());
+        mPendingJobs.pop_back();
+        if (!headerCoverage)
+            return ret;
+
+        // Greedy set cover with lazy updates. Coverage goes down as headers
+        // are claimed so if the recalculated value is still what put this job
+        // on top of the heap it's the right one.
+        Set<uint32_t> headers;
+        const uint32_t current = coverage(ret->job, &headers);
+        if (current >= ret->coverage || mPendingJobs.empty()) {
+            *claimed = std::move(headers);
+            return ret;
+        }
+        ret->coverage = current;
+        mPendingJobs.push_back(std::move(ret));
+        std::push_heap(mPendingJobs.begin(), mPendingJobs.end(), &JobScheduler::lessUrgent);
+    }
+}
+
+uint32_t JobScheduler::coverage(const std::shared_ptr<IndexerJob> &job, Set<uint32_t> *headers) const
+{
+    if (!(Server::instance()->options().options & Server::HeaderCoverageScheduling))
+        return 0;
+    std::shared_ptr<Project> project = Server::instance()->project(job->project);
+    if (!project)
+        return 0;
+    uint32_t ret = 0;
+    for (uint32_t dep : project->dependencies(job->fileId(), Project::ArgDependsOn)) {
+        if (!mClaimedHeaders.contains(dep)) {
+            ++ret;
+            if (headers)
+                headers->insert(dep);
+        }
+    }
+    return ret;
+}
+
+uint32_t JobScheduler::predictedDuration(uint32_t fileId) const
+{
+    const auto it = mCosts.find(fileId);
+    if (it != mCosts.end())
+        return it->second.duration;
+    // never seen it, assume it's an average one
+    return mCosts.isEmpty() ? 0 : static_cast<uint32_t>(mTotalCostDuration / mCosts.size());
+}
+
+uint64_t JobScheduler::predictedPeakMemory(uint32_t fileId) const
+{
+    const auto it = mCosts.find(fileId);
+    if (it != mCosts.end())
+        return it->second.peakMemory;
+    return mCosts.isEmpty() ? 0 : mTotalCostPeakMemory / mCosts.size();
+}
+
+void JobScheduler::updateCost(uint32_t fileId, uint32_t duration, const std::shared_ptr<IndexDataMessage> &message)
+{
+    Cost &cost = mCosts[fileId];
+    if (!cost.samples) {
+        cost.duration = duration;
+        cost.peakMemory = message->peakMemory();
+        cost.bytesWritten = message->bytesWritten();
+    } else {
+        mTotalCostDuration -= cost.duration;
+        mTotalCostPeakMemory -= cost.peakMemory;
+        cost.duration = (cost.duration * 3 + duration) / 4;
+        cost.peakMemory = (cost.peakMemory * 3 + message->peakMemory()) / 4;
+        cost.bytesWritten = (cost.bytesWritten * 3 + message->bytesWritten()) / 4;
+    }
+    ++cost.samples;
+    mTotalCostDuration += cost.duration;
+    mTotalCostPeakMemory += cost.peakMemory;
+    mCostsDirty = true;
+}
+
+void JobScheduler::loadCosts()
+{
+    DataFile file(Server::instance()->options().dataDir + "jobcosts", RTags::DatabaseVersion);
+    if (!file.open(DataFile::Read))
+        return;
+    file >> mCosts;
+    mTotalCostDuration = mTotalCostPeakMemory = 0;
+    for (const auto &cost : mCosts) {
+        mTotalCostDuration += cost.second.duration;
+        mTotalCostPeakMemory += cost.second.peakMemory;
+    }
+}
+
+bool JobScheduler::saveCosts()
+{
+    if (!mCostsDirty)
+        return true;
+    DataFile file(Server::instance()->options().dataDir + "jobcosts", RTags::DatabaseVersion);
+    if (!file.open(DataFile::Write)) {
+        error("Can't save job costs: %s", file.error().constData());
+        return false;
+    }
+    file << mCosts;
+    if (!file.flush()) {
+        error("Can't save job costs: %s", file.error().constData());
+        return false;
+    }
+    mCostsDirty = false;
+    return true;
+}
+
+struct SystemLoad {
+    double load;
+    uint64_t memTotal, memAvailable;
+    double cpuPressure, memoryPressure; // some avg10, percent
+};
+
+static double pressure(const char *file)
+{
+    const String data = Path(file).readAll();
+    const char *some = strstr(data.constData(), "some avg10=");
+    return some ? atof(some + 11) : 0;
+}
+
+static bool sampleLoad(SystemLoad &load)
+{
+    memset(&load, 0, sizeof(load));
+    if (getloadavg(&load.load, 1) != 1)
+        return false;
+    const String meminfo = Path("/proc/meminfo").readAll();
+    const char *total = strstr(meminfo.constData(), "MemTotal:");
+    const char *available = strstr(meminfo.constData(), "MemAvailable:");
+    if (total && available) {
+        load.memTotal = strtoull(total + 9, 0, 10) * 1024;
+        load.memAvailable = strtoull(available + 13, 0, 10) * 1024;
+    }
+    load.cpuPressure = pressure("/proc/pressure/cpu");
+    load.memoryPressure = pressure("/proc/pressure/memory");
+    return true;
+}
+
+void JobScheduler::updateTargetJobCount()
+{
+    const auto &options = Server::instance()->options();
+    if (!(options.options & Server::AdaptiveJobCount)) {
+        mTargetJobCount = options.jobCount;
+        return;
+    }
+    const unsigned long long now = Rct::monoMs();
+    if (mTargetJobCount && now - mLastLoadSample < 1000)
+        return;
+    mLastLoadSample = now;
+
+    SystemLoad load;
+    size_t target = std::max<size_t>(1, options.jobCount);
+    mMemoryHeadroom = UINT64_MAX;
+    if (!sampleLoad(load)) {
+        mTargetJobCount = target;
+        mLoadState = "no load information";
+        return;
+    }
+    // whatever load isn't ours is competing for the cores
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    const double foreign = std::max(0.0, load.load - mActiveByProcess.size());
+    if (cpus > 0)
+        target = std::min<size_t>(target, std::max<long>(1, cpus - lround(foreign)));
+    if (load.cpuPressure > 50)
+        target = std::max<size_t>(1, target - target / 4);
+    if (load.memoryPressure > 10)
+        target = std::max<size_t>(1, target / 2);
+    if (load.memTotal) {
+        // keep a tenth of the machine for everyone else
+        const uint64_t reserve = load.memTotal / 10;
+        mMemoryHeadroom = load.memAvailable > reserve ? load.memAvailable - reserve : 0;
+    }
+    mTargetJobCount = target;
+    mLoadState = String::format<256>("load %.2f, %llumb available of %llumb, pressure cpu %.1f%% memory %.1f%%",
+                                     load.load,
+                                     static_cast<unsigned long long>(load.memAvailable / (1024 * 1024)),
+                                     static_cast<unsigned long long>(load.memTotal / (1024 * 1024)),
+                                     load.cpuPressure, load.memoryPressure);
+}
+
 uint32_t JobScheduler::hasHeaderError(DependencyNode *node, Set<uint32_t> &seen) const
 {
     assert(node);
@@ -97,25 +305,61 @@ void JobScheduler::startJobs()
         return;
     }
     const auto &options = server->options();
-    std::shared_ptr<Node> jobNode = mPendingJobs.first();
-    auto cont = [&jobNode, this]() {
-        auto tmp = jobNode->next;
-        mPendingJobs.remove(jobNode);
-        jobNode = tmp;
-    };
-
-    while (mActiveByProcess.size() < options.jobCount && jobNode) {
+    const bool adaptive = options.options & Server::AdaptiveJobCount;
+    updateTargetJobCount();
+    uint64_t headroom = mMemoryHeadroom;
+    if (adaptive && headroom != UINT64_MAX) {
+        // jobs started since the last sample aren't reflected in it yet
+        for (const auto &active : mActiveByProcess) {
+            if (active.second->started >= mLastLoadSample) {
+                const uint64_t peak = predictedPeakMemory(active.second->job->fileId());
+                headroom = headroom > peak ? headroom - peak : 0;
+            }
+        }
+    }
+    std::shared_ptr<Node> deferred;
+    while (mActiveByProcess.size() < mTargetJobCount && !mPendingJobs.empty()) {
+        Set<uint32_t> headers;
+        const std::shared_ptr<Node> jobNode = takeFirst(&headers);
         assert(jobNode);
+        if (adaptive && headroom != UINT64_MAX && !mActiveByProcess.isEmpty()) {
+            const uint64_t peak = predictedPeakMemory(jobNode->job->fileId());
+            if (peak > headroom) {
+                // Wait for some memory to be freed up, always let one job run
+                // though. Nothing behind it gets to go first, smaller jobs
+                // would keep it waiting forever.
+                deferred = jobNode;
+                break;
+            }
+            headroom -= peak;
+        }
+        mClaimedHeaders.unite(headers);
         assert(jobNode->job);
         assert(!(jobNode->job->flags & (IndexerJob::Running|IndexerJob::Complete|IndexerJob::Crashed|IndexerJob::Aborted)));
         std::shared_ptr<Project> project = Server::instance()->project(jobNode->job->project);
         if (!project) {
-            cont();
             debug() << jobNode->job->sourceFile << "doesn't have a project, discarding";
             continue;
         }
 
         const uint64_t jobId = jobNode->job->id;
+        if (options.options & Server::ResidentTranslationUnits
+            && jobNode->job->flags & IndexerJob::Active
+            && jobNode->job->sources.size() == 1
+            && !mResidentBusy
+            && startResidentProcess()) {
+            debug() << "Starting resident job" << jobId << jobNode->job->fileId() << jobNode->job.get();
+            mResidentBusy = true;
+            jobNode->process = mResidentProcess;
+            jobNode->job->flags |= IndexerJob::Running;
+            mResidentProcess->write(jobNode->job->encode());
+            jobNode->started = Rct::monoMs();
+            mActiveByProcess[mResidentProcess] = jobNode;
+            mInactiveById.remove(jobId);
+            mActiveById[jobId] = jobNode;
+            continue;
+        }
+
         Process *process = new Process;
         debug() << "Starting process for" << jobId << jobNode->job->fileId() << jobNode->job.get();
         List<String> arguments;
@@ -145,10 +389,9 @@ void JobScheduler::startJobs()
             auto msg = std::make_shared<IndexDataMessage>(jobNode->job);
             msg->setFlag(IndexDataMessage::ParseFailure);
             jobFinished(jobNode->job, msg);
-            cont();
             continue;
         }
-        process->finished().connect([this, jobId](Process *proc) {
+        process->finished().connect([this](Process *proc) {
                 EventLoop::deleteLater(proc);
                 auto n = mActiveByProcess.take(proc);
                 assert(!n || n->process == proc);
@@ -162,17 +405,8 @@ void JobScheduler::startJobs()
                     assert(n->process == proc);
                     n->process = 0;
                     assert(!(n->job->flags & IndexerJob::Aborted));
-                    if (!(n->job->flags & IndexerJob::Complete) && proc->returnCode() != 0) {
-                        auto nodeById = mActiveById.take(jobId);
-                        assert(nodeById);
-                        assert(nodeById == n);
-                        // job failed, probably no IndexDataMessage coming
-                        n->job->flags |= IndexerJob::Crashed;
-                        debug() << "job crashed" << jobId << n->job->fileId() << n->job.get();
-                        auto msg = std::make_shared<IndexDataMessage>(n->job);
-                        msg->setFlag(IndexDataMessage::ParseFailure);
-                        jobFinished(n->job, msg);
-                    }
+                    if (!(n->job->flags & IndexerJob::Complete) && proc->returnCode() != 0)
+                        crashed(n);
                 }
                 startJobs();
             });
@@ -187,8 +421,120 @@ void JobScheduler::startJobs()
         // error() << "STARTING JOB" << node->job->sourceFile;
         mInactiveById.remove(jobId);
         mActiveById[jobId] = jobNode;
-        cont();
     }
+    if (deferred) {
+        mPendingJobs.push_back(deferred);
+        std::push_heap(mPendingJobs.begin(), mPendingJobs.end(), &JobScheduler::lessUrgent);
+        mDeferredJobs = mPendingJobs.size();
+        // memory might free up without any of our jobs finishing
+        if (mDeferTimer < 0) {
+            mDeferTimer = EventLoop::eventLoop()->registerTimer([this](int) {
+                    mDeferTimer = -1;
+                    startJobs();
+                }, 1000, Timer::SingleShot);
+        }
+    } else {
+        mDeferredJobs = 0;
+    }
+}
+
+void JobScheduler::crashed(const std::shared_ptr<Node> &node)
+{
+    auto nodeById = mActiveById.take(node->job->id);
+    assert(nodeById);
+    assert(nodeById == node);
+    (void)nodeById;
+    // job failed, probably no IndexDataMessage coming
+    node->job->flags |= IndexerJob::Crashed;
+    debug() << "job crashed" << node->job->id << node->job->fileId() << node->job.get();
+    auto msg = std::make_shared<IndexDataMessage>(node->job);
+    msg->setFlag(IndexDataMessage::ParseFailure);
+    jobFinished(node->job, msg);
+}
+
+bool JobScheduler::startResidentProcess()
+{
+    if (mResidentProcess)
+        return true;
+    const auto &options = Server::instance()->options();
+    List<String> arguments;
+    arguments << "--resident";
+    for (int i=logLevel().toInt(); i>0; --i)
+        arguments << "-v";
+
+    Process *process = new Process;
+    process->readyReadStdOut().connect(std::bind(&JobScheduler::onResidentStdOut, this, std::placeholders::_1));
+    if (!process->start(options.rp, arguments)) {
+        error() << "Couldn't start resident rp" << options.rp << process->errorString();
+        delete process;
+        return false;
+    }
+    process->finished().connect(std::bind(&JobScheduler::onResidentFinished, this, std::placeholders::_1));
+    mResidentProcess = process;
+    mResidentBusy = false;
+    mResidentStdOut.clear();
+    setActiveBuffers(Server::instance()->activeBuffers());
+    return true;
+}
+
+void JobScheduler::onResidentStdOut(Process *process)
+{
+    mResidentStdOut.append(process->readAllStdOut());
+
+    std::regex rx("@(CRASH|RESIDENT)@([^@]*)@\\1@");
+    std::smatch match;
+    bool finished = false;
+    while (std::regex_search(mResidentStdOut.ref(), match, rx)) {
+        if (match[1].str() == "CRASH") {
+            error() << match[2].str();
+        } else {
+            // an aborted job is no longer in mActiveByProcess
+            mResidentBusy = false;
+            finished = true;
+            auto n = mActiveByProcess.take(process);
+            if (n) {
+                n->process = 0;
+                if (!(n->job->flags & IndexerJob::Complete) && match[2].str() != "0")
+                    crashed(n);
+            }
+        }
+        mResidentStdOut.remove(match.position(), match.length());
+    }
+    if (finished)
+        startJobs();
+}
+
+void JobScheduler::onResidentFinished(Process *process)
+{
+    EventLoop::deleteLater(process);
+    assert(process == mResidentProcess);
+    mResidentProcess = 0;
+    mResidentBusy = false;
+    auto n = mActiveByProcess.take(process);
+    const String stdErr = process->readAllStdErr();
+    if (!mResidentStdOut.isEmpty() || !stdErr.isEmpty())
+        error() << "Output from resident rp:" << '\n' << stdErr << mResidentStdOut;
+    mResidentStdOut.clear();
+    if (n) {
+        n->process = 0;
+        if (!(n->job->flags & IndexerJob::Complete))
+            crashed(n);
+    }
+    startJobs();
+}
+
+void JobScheduler::setActiveBuffers(const Set<uint32_t> &fileIds)
+{
+    if (!mResidentProcess)
+        return;
+    String data;
+    {
+        Serializer serializer(data);
+        serializer << static_cast<uint32_t>(0) << static_cast<uint32_t>(fileIds.size());
+        for (uint32_t fileId : fileIds)
+            serializer << fileId;
+    }
+    mResidentProcess->write(data);
 }
 
 void JobScheduler::handleIndexDataMessage(const std::shared_ptr<IndexDataMessage> &message)
@@ -199,7 +545,14 @@ void JobScheduler::handleIndexDataMessage(const std::shared_ptr<IndexDataMessage
         return;
     }
     debug() << "job got index data message" << node->job->id << node->job->fileId() << node->job.get();
+    // reparsing a resident unit says little about what a fresh rp would cost
+    if (!(message->flags() & IndexDataMessage::ParseFailure) && (!mResidentProcess || node->process != mResidentProcess))
+        updateCost(node->job->fileId(), static_cast<uint32_t>(Rct::monoMs() - node->started), message);
     jobFinished(node->job, message);
+    if (mPendingJobs.empty() && mActiveById.isEmpty()) {
+        saveCosts();
+        mClaimedHeaders.clear();
+    }
 }
 
 void JobScheduler::jobFinished(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexDataMessage> &message)
@@ -248,27 +601,44 @@ void JobScheduler::jobFinished(const std::shared_ptr<IndexerJob> &job, const std
 
 void JobScheduler::dump(const std::shared_ptr<Connection> &conn)
 {
-    if (!mPendingJobs.isEmpty()) {
+    uint64_t remaining = 0;
+    if (!mPendingJobs.empty()) {
         conn->write("Pending:");
-        for (const auto &node : mPendingJobs) {
-            conn->write<128>("%s: %s %s",
+        std::vector<std::shared_ptr<Node> > sorted = mPendingJobs;
+        std::sort_heap(sorted.begin(), sorted.end(), &JobScheduler::lessUrgent);
+        for (auto it = sorted.rbegin(); it != sorted.rend(); ++it) {
+            const std::shared_ptr<Node> &node = *it;
+            conn->write<128>("%s: %s %s ~%ums",
                              node->job->sourceFile.constData(),
                              node->job->flags.toString().constData(),
-                             IndexerJob::dumpFlags(node->job->flags).constData());
+                             IndexerJob::dumpFlags(node->job->flags).constData(),
+                             node->predicted);
+            remaining += node->predicted;
         }
     }
     if (!mActiveById.isEmpty()) {
         conn->write("Active:");
         const unsigned long long now = Rct::monoMs();
         for (const auto &node : mActiveById) {
-            conn->write<128>("%s: %s %s %lldms",
+            const unsigned long long elapsed = now - node.second->started;
+            conn->write<128>("%s: %s %s %lldms (~%ums)",
                              node.second->job->sourceFile.constData(),
                              node.second->job->flags.toString().constData(),
                              IndexerJob::dumpFlags(node.second->job->flags).constData(),
-                             now - node.second->started);
-
+                             elapsed, node.second->predicted);
+            if (node.second->predicted > elapsed)
+                remaining += node.second->predicted - elapsed;
         }
     }
+    const auto &options = Server::instance()->options();
+    if (options.options & Server::AdaptiveJobCount) {
+        conn->write<512>("Concurrency: %zu of %zu (%s)%s", mTargetJobCount, options.jobCount, mLoadState.constData(),
+                         mDeferredJobs ? String::format<64>(", %zu jobs deferred for memory", mDeferredJobs).constData() : "");
+    }
+    if (remaining) {
+        const size_t jobCount = std::max<size_t>(1, mTargetJobCount ? mTargetJobCount : options.jobCount);
+        conn->write<128>("ETA: %.1fs (%zu jobs with history)", (remaining / jobCount) / 1000.0, mCosts.size());
+    }
 }
 
 void JobScheduler::abort(const std::shared_ptr<IndexerJob> &job)
@@ -284,11 +654,19 @@ void JobScheduler::abort(const std::shared_ptr<IndexerJob> &job)
         debug() << "Aborting inactive job" << job->sourceFile << job->fileId() << job->id << job.get();
         node = mInactiveById.take(job->id);
         assert(node);
-        mPendingJobs.remove(node);
+        auto it = std::find(mPendingJobs.begin(), mPendingJobs.end(), node);
+        if (it != mPendingJobs.end()) {
+            mPendingJobs.erase(it);
+            std::make_heap(mPendingJobs.begin(), mPendingJobs.end(), &JobScheduler::lessUrgent);
+        }
     } else {
         debug() << "Aborting active job" << job->sourceFile << job->fileId() << job->id << job.get();
     }
-    if (node->process) {
+    if (node->process == mResidentProcess && mResidentProcess) {
+        // the resident rp is shared, let it finish and ignore the result
+        mActiveByProcess.remove(node->process);
+        node->process = 0;
+    } else if (node->process) {
         debug() << "Killing process" << node->process;
         node->process->kill();
         mActiveByProcess.remove(node->process);
@@ -303,18 +681,10 @@ void JobScheduler::clearHeaderError(uint32_t file)
 
 void JobScheduler::sort()
 {
-    std::vector<std::shared_ptr<Node> > nodes(mPendingJobs.size());
-    for (size_t i=0; i<nodes.size(); ++i) {
-        std::shared_ptr<Node> node = mPendingJobs.removeFirst();
+    for (const std::shared_ptr<Node> &node : mPendingJobs) {
         node->job->recalculatePriority();
-        nodes[i] = std::move(node);
-    }
-
-    std::stable_sort(nodes.begin(), nodes.end(), [](const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r) -> bool {
-            return l->job->priority() > r->job->priority();
-        });
-
-    for (std::shared_ptr<Node> &n : nodes) {
-        mPendingJobs.append(std::move(n));
+        node->predicted = predictedDuration(node->job->fileId());
+        node->coverage = coverage(node->job);
     }
+    std::make_heap(mPendingJobs.begin(), mPendingJobs.end(), &JobScheduler::lessUrgent);
 }
@@ -17,10 +17,11 @@
 #define JobScheduler_h
 
 #include <memory>
+#include <vector>
 
-#include "rct/EmbeddedLinkedList.h"
 #include "rct/Set.h"
 #include "rct/Hash.h"
+#include "rct/Serializer.h"
 #include "rct/String.h"
 
 class Connection;
@@ -64,24 +65,81 @@ public:
     size_t pendingJobCount() const { return mPendingJobs.size(); }
     size_t activeJobCount() const { return mActiveById.size(); }
     void sort();
+    // --resident-translation-units, lets the resident rp drop the units of
+    // buffers that are no longer active
+    void setActiveBuffers(const Set<uint32_t> &fileIds);
+
+    // What indexing a source cost the last few times, moving averages
+    struct Cost {
+        uint32_t duration; // ms
+        uint64_t peakMemory, bytesWritten;
+        uint32_t samples;
+    };
+    const Hash<uint32_t, Cost> &costs() const { return mCosts; }
+    uint32_t predictedDuration(uint32_t fileId) const;
+    uint64_t predictedPeakMemory(uint32_t fileId) const;
+    bool saveCosts();
 private:
     enum { HighPriority = 5 };
     void jobFinished(const std::shared_ptr<IndexerJob> &job, const std::shared_ptr<IndexDataMessage> &message);
+    void updateCost(uint32_t fileId, uint32_t duration, const std::shared_ptr<IndexDataMessage> &message);
+    void loadCosts();
     struct Node {
         unsigned long long started;
         std::shared_ptr<IndexerJob> job;
         Process *process;
-        std::shared_ptr<Node> next, prev;
+        uint64_t sequence;
+        uint32_t predicted;
+        uint32_t coverage; // headers no started job includes, only with --header-coverage-scheduling
         String stdOut;
     };
+    // heap order, highest priority first, then the job covering the most
+    // unclaimed headers, then the longest job first and otherwise in the
+    // order they were added
+    static bool lessUrgent(const std::shared_ptr<Node> &l, const std::shared_ptr<Node> &r);
+    std::shared_ptr<Node> takeFirst(Set<uint32_t> *headers);
+    void updateTargetJobCount();
+    uint32_t coverage(const std::shared_ptr<IndexerJob> &job, Set<uint32_t> *headers = 0) const;
     uint32_t hasHeaderError(DependencyNode *node, Set<uint32_t> &seen) const;
     uint32_t hasHeaderError(uint32_t file, const std::shared_ptr<Project> &project) const;
+    void crashed(const std::shared_ptr<Node> &node);
+    bool startResidentProcess();
+    void onResidentStdOut(Process *process);
+    void onResidentFinished(Process *process);
 
     int mProcrastination;
-    Set<uint32_t> mHeaderErrors;
-    EmbeddedLinkedList<std::shared_ptr<Node> > mPendingJobs;
+    uint64_t mSequence;
+    Set<uint32_t> mHeaderErrors, mClaimedHeaders;
+    std::vector<std::shared_ptr<Node> > mPendingJobs;
+    Hash<uint32_t, Cost> mCosts;
+    uint64_t mTotalCostDuration, mTotalCostPeakMemory;
+    bool mCostsDirty;
+
+    // --adaptive-job-count
+    unsigned long long mLastLoadSample;
+    size_t mTargetJobCount, mDeferredJobs;
+    int mDeferTimer; // samples the load again while jobs wait for memory
+    uint64_t mMemoryHeadroom;
+    String mLoadState;
     Hash<Process *, std::shared_ptr<Node> > mActiveByProcess;
     Hash<uint64_t, std::shared_ptr<Node> > mActiveById, mInactiveById;
+
+    // --resident-translation-units, runs one active job at a time
+    Process *mResidentProcess;
+    bool mResidentBusy;
+    String mResidentStdOut;
 };
 
+template <> inline Serializer &operator<<(Serializer &s, const JobScheduler::Cost &cost)
+{
+    s << cost.duration << cost.peakMemory << cost.bytesWritten << cost.samples;
+    return s;
+}
+
+template <> inline Deserializer &operator>>(Deserializer &s, JobScheduler::Cost &cost)
+{
+    s >> cost.duration >> cost.peakMemory >> cost.bytesWritten >> cost.samples;
+    return s;
+}
+
 #endif
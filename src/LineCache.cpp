@@ -0,0 +1,107 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "LineCache.h"
+
+#include <string.h>
+
+#include "Location.h"
+#include "rct/Path.h"
+#include "rct/Rct.h"
+
+LineCache::LineCache(size_t maxSize)
+    : mMaxSize(maxSize), mSize(0), mCounter(0)
+{
+}
+
+bool LineCache::line(uint32_t fileId, unsigned int line, String &out)
+{
+    if (!line)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    const uint64_t now = Rct::monoMs();
+    auto it = mFiles.find(fileId);
+    if (it != mFiles.end() && now - it->second.checked > ValidateInterval) {
+        it->second.checked = now;
+        if (Location::path(fileId).lastModifiedMs() != it->second.lastModified) {
+            remove(fileId);
+            it = mFiles.end();
+        }
+    }
+
+    if (it == mFiles.end()) {
+        const Path path = Location::path(fileId);
+        File file;
+        file.lastModified = path.lastModifiedMs();
+        file.contents = path.readAll();
+        if (file.contents.isEmpty())
+            return false;
+        file.checked = now;
+        file.lines.append(0);
+        const char *data = file.contents.constData();
+        const char *end = data + file.contents.size();
+        for (const char *ch = data; (ch = static_cast<const char*>(memchr(ch, '\n', end - ch))); ++ch)
+            file.lines.append(ch - data + 1);
+
+        mSize += file.contents.size();
+        while (mSize > mMaxSize && !mFiles.isEmpty()) {
+            auto oldest = mFiles.begin();
+            for (auto f = mFiles.begin(); f != mFiles.end(); ++f) {
+                if (f->second.lastUsed < oldest->second.lastUsed)
+                    oldest = f;
+            }
+            remove(oldest->first);
+        }
+        it = mFiles.insert(std::make_pair(fileId, std::move(file))).first;
+    }
+
+    File &file = it->second;
+    file.lastUsed = ++mCounter;
+    if (line > file.lines.size())
+        return false;
+    const uint32_t start = file.lines.at(line - 1);
+    const uint32_t end = line < file.lines.size() ? file.lines.at(line) - 1 : file.contents.size();
+    out.assign(file.contents.constData() + start, end - start);
+    return true;
+}
+
+void LineCache::invalidate(uint32_t fileId)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    remove(fileId);
+}
+
+void LineCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFiles.clear();
+    mSize = 0;
+}
+
+size_t LineCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSize;
+}
+
+void LineCache::remove(uint32_t fileId)
+{
+    auto it = mFiles.find(fileId);
+    if (it != mFiles.end()) {
+        mSize -= it->second.contents.size();
+        mFiles.erase(it);
+    }
+}
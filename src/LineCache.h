@@ -0,0 +1,61 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef LineCache_h
+#define LineCache_h
+
+#include <cstdint>
+#include <mutex>
+
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/String.h"
+
+// The files rdm prints context lines from, with the offset of every line
+// so printing one is a lookup. Shared by all queries, Project invalidates
+// files its watcher sees change and files nothing watches are checked
+// against their modification time at most once per ValidateInterval.
+class LineCache
+{
+public:
+    enum {
+        DefaultMaxSize = 128 * 1024 * 1024,
+        ValidateInterval = 1000 // ms
+    };
+
+    LineCache(size_t maxSize = DefaultMaxSize);
+
+    // line is 1-based, the returned line doesn't include the newline
+    bool line(uint32_t fileId, unsigned int line, String &out);
+    void invalidate(uint32_t fileId);
+    void clear();
+
+    size_t size() const;
+private:
+    struct File {
+        String contents;
+        List<uint32_t> lines; // offset of the start of each line
+        uint64_t lastModified, checked, lastUsed;
+    };
+    void remove(uint32_t fileId);
+
+    mutable std::mutex mMutex;
+    Hash<uint32_t, File> mFiles;
+    const size_t mMaxSize;
+    size_t mSize;
+    uint64_t mCounter;
+};
+
+#endif
@@ -75,39 +75,41 @@ String Location::toString(Flags<ToStringFlag> flags, Hash<Path, String> *context
 
 String Location::context(Flags<ToStringFlag> flags, Hash<Path, String> *cache) const
 {
-    String copy;
-    String *code = 0;
-    const Path p = path();
-
-    auto readAll = [&p, this]() {
-        if (Server::instance()) {
-            if (auto project = Server::instance()->currentProject()) {
-                const Path f = project->sourceFilePath(fileId(), "unsaved");
-                String contents = f.readAll();
-                if (!contents.isEmpty())
-                    return contents;
-            }
-        }
-        return p.readAll();
+    const unsigned int l = line();
+    if (!l)
+        return String();
+
+    // With a server the files themselves come from its line cache, only
+    // unsaved copies are read here. An empty string means there isn't one.
+    Server *server = Server::instance();
+    auto contents = [this, server]() {
+        if (!server)
+            return path().readAll();
+        if (auto project = server->currentProject())
+            return project->unsavedFile(fileId());
+        return String();
     };
+    String copy;
+    const String *code = 0;
     if (cache) {
-        String &ref = (*cache)[p];
-        if (ref.isEmpty()) {
-            ref = readAll();
-        }
-        code = &ref;
+        const Path p = path();
+        auto it = cache->find(p);
+        if (it == cache->end())
+            it = cache->insert(std::make_pair(p, contents())).first;
+        code = &it->second;
     } else {
-        copy = readAll();
+        copy = contents();
         code = &copy;
     }
 
     String ret;
-    if (!code->isEmpty()) {
-        unsigned int l = line();
-        if (!l)
+    if (code->isEmpty()) {
+        if (!server || !server->lineCache().line(fileId(), l, ret))
             return String();
+    } else {
+        unsigned int remaining = l;
         const char *ch = code->constData();
-        while (--l) {
+        while (--remaining) {
             ch = strchr(ch, '\n');
             if (!ch)
                 return String();
@@ -116,25 +118,25 @@ String Location::context(Flags<ToStringFlag> flags, Hash<Path, String> *cache) c
         const char *end = strchr(ch, '\n');
         if (!end)
             return String();
-
         ret.assign(ch, end - ch);
-        // error() << "foobar" << ret << bool(flags & NoColor);
-        if (!(flags & NoColor)) {
-            const size_t col = column() - 1;
-            if (col + 1 < ret.size()) {
-                size_t last = col;
-                if (ret.at(last) == '~')
-                    ++last;
-                while (ret.size() > last && (isalnum(ret.at(last)) || ret.at(last) == '_'))
-                    ++last;
-                static const char *color = "\x1b[32;1m"; // dark yellow
-                static const char *resetColor = "\x1b[0;0m";
-                // error() << "foobar"<< end << col << ret.size();
-                ret.insert(last, resetColor);
-                ret.insert(col, color);
-            }
-            // printf("[%s]\n", ret.constData());
+    }
+
+    // error() << "foobar" << ret << bool(flags & NoColor);
+    if (!(flags & NoColor)) {
+        const size_t col = column() - 1;
+        if (col + 1 < ret.size()) {
+            size_t last = col;
+            if (ret.at(last) == '~')
+                ++last;
+            while (ret.size() > last && (isalnum(ret.at(last)) || ret.at(last) == '_'))
+                ++last;
+            static const char *color = "\x1b[32;1m"; // dark yellow
+            static const char *resetColor = "\x1b[0;0m";
+            // error() << "foobar"<< end << col << ret.size();
+            ret.insert(last, resetColor);
+            ret.insert(col, color);
         }
+        // printf("[%s]\n", ret.constData());
     }
     return ret;
 }
@@ -36,6 +36,8 @@
 #include "RTags.h"
 #include "RTagsLogOutput.h"
 #include "Server.h"
+#include "SymbolNameSuffix.h"
+#include "UnitManifest.h"
 #include "RTagsVersion.h"
 
 enum { DirtyTimeout = 100, ReloadCompileCommandsTimeout = 500 };
@@ -262,6 +264,8 @@ Project::Project(const Path &path)
 {
     mProjectFilePath = mProjectDataDir + "project";
     mSourcesFilePath = mProjectDataDir + "sources";
+    if (Server::instance()->options().options & Server::SegmentedStorage)
+        mSegments.reset(new SegmentedDatabase(SegmentedDatabase::segmentPath(mProjectDataDir)));
 }
 
 Project::~Project()
@@ -359,10 +363,18 @@ bool Project::init()
                 }
                 return Path::Continue;
             });
+        if (mSegments)
+            mSegments->clear();
         auto parseData = std::move(mIndexParseData);
         processParseData(std::move(parseData));
     };
 
+    if (mSegments && !mSegments->refresh(&err)) {
+        error("Restore error %s: %s", mPath.constData(), err.constData());
+        reindexAll();
+        return true;
+    }
+
     DataFile file(mProjectFilePath, RTags::DatabaseVersion);
     if (!file.open(DataFile::Read)) {
         if (!file.error().isEmpty())
@@ -750,9 +762,16 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
         error() << "Can't find source for" << Location::path(fileId);
         return;
     }
+    if (mSegments) {
+        String err;
+        if (!mSegments->refresh(&err))
+            error() << "Failed to refresh" << mSegments->path() << err;
+    }
     if (!(msg->flags() & IndexDataMessage::ParseFailure)) {
         for (uint32_t file : job->visited) {
-            if (!validate(file, Validate)) {
+            String err;
+            if (!validateManifest(file, UnitManifest::generation(msg->id(), msg->parseTime()), &err)) {
+                error() << err;
                 releaseFileIds(job->visited);
                 dirty(fileId);
                 return;
@@ -820,6 +839,8 @@ void Project::onJobFinished(const std::shared_ptr<IndexerJob> &job, const std::s
                                               static_cast<unsigned long long>(MemoryMonitor::usage() / (1024 * 1024)));
         Log(LogLevel::Error, LogOutput::StdOut|LogOutput::TrailingNewLine) << m;
         mJobsStarted = mJobCounter = 0;
+        if (mSegments)
+            mSegments->compact();
 
         // error() << "Finished this
     } else {
@@ -967,6 +988,7 @@ void Project::onFileAddedOrModified(const Path &file)
     debug() << file << "was modified" << fileId;
     if (!fileId)
         return;
+    Server::instance()->lineCache().invalidate(fileId);
     // error() << file.fileName() << mCompileCommandsInfos.dir << file;
     if (mIndexParseData.compileCommands.contains(fileId)) {
         mReloadCompileCommandsTimer.restart(ReloadCompileCommandsTimeout, Timer::SingleShot);
@@ -989,6 +1011,7 @@ void Project::onFileRemoved(const Path &file)
     debug() << file << "was removed" << fileId;
     if (!fileId)
         return;
+    Server::instance()->lineCache().invalidate(fileId);
 
     if (mIndexParseData.compileCommands.contains(fileId)) {
         reloadCompileCommands();
@@ -1442,20 +1465,51 @@ void Project::findSymbols(const String &unencoded,
         auto symNames = openSymbolNames(file);
         if (!symNames)
             return;
-        const int count = symNames->count();
+        auto suffixes = openSymbolNameSuffixes(file);
+        if (!suffixes)
+            return;
+        // Every entry names a suffix of one of the canonical names in
+        // symNames. They are sorted by that suffix, not by key. Only the
+        // names the search actually touches are read.
+        Hash<uint32_t, String> keys;
+        auto key = [&keys, &symNames](uint32_t keyIndex) -> const String & {
+            String &ret = keys[keyIndex];
+            if (ret.isEmpty())
+                ret = symNames->keyAt(keyIndex);
+            return ret;
+        };
+        const uint32_t count = suffixes->count();
         // error() << "Looking at" << count << Location::path(dep.first)
         //         << lowerBound << string;
         uint32_t idx = 0;
         if (!lowerBound.isEmpty()) {
-            idx = symNames->lowerBound(lowerBound);
-            if (idx == std::numeric_limits<uint32_t>::max()) {
-                return;
+            const SymbolNameSuffix::Name bound(lowerBound);
+            uint32_t last = count;
+            while (idx < last) {
+                const uint32_t mid = idx + ((last - idx) / 2);
+                const uint64_t entry = suffixes->valueAt(mid);
+                if (SymbolNameSuffix::compare(SymbolNameSuffix::Name(key(SymbolNameSuffix::keyIndex(entry)), entry), bound) < 0) {
+                    idx = mid + 1;
+                } else {
+                    last = mid;
+                }
             }
         }
 
-        for (int i=idx; i<count; ++i) {
-            const String entry = symNames->keyAt(i);
+        // The same name can come from several canonical names, they're
+        // adjacent so we can hand them out as one.
+        String previous;
+        SymbolMatchType previousType = Exact;
+        Set<Location> locations;
+        for (uint32_t i=idx; i<count; ++i) {
+            const uint64_t value = suffixes->valueAt(i);
+            const uint32_t keyIndex = SymbolNameSuffix::keyIndex(value);
+            const String entry = SymbolNameSuffix::Name(key(keyIndex), value).toString();
             // error() << i << count << entry;
+            if (!locations.isEmpty() && entry == previous) {
+                locations.unite(symNames->valueAt(keyIndex));
+                continue;
+            }
             SymbolMatchType type = Exact;
             if (!string.isEmpty()) {
                 if (wildcard) {
@@ -1478,8 +1532,14 @@ void Project::findSymbols(const String &unencoded,
                     type = StartsWith;
                 }
             }
-            inserter(type, entry, symNames->valueAt(i));
+            if (!locations.isEmpty())
+                inserter(previousType, previous, locations);
+            previous = entry;
+            previousType = type;
+            locations = symNames->valueAt(keyIndex);
         }
+        if (!locations.isEmpty())
+            inserter(previousType, previous, locations);
     };
 
     if (fileFilter) {
@@ -2114,44 +2174,170 @@ void Project::dirty(uint32_t fileId)
     startDirtyJobs(&dirty, IndexerJob::Dirty);
 }
 
+class TokenizeThread : public Thread
+{
+public:
+    TokenizeThread(const Path &path, const String &contents)
+        : mPath(path), mContents(contents)
+    {}
+
+    virtual void run() override
+    {
+        StopWatch sw;
+        if (mContents.isEmpty())
+            mContents = mPath.readAll();
+
+        // We only need the lexer. Nothing on the include path, not even the
+        // system headers, so a tokens request never parses more than this file.
+        const char *suffix = mPath.extension();
+        const char *language = "c++";
+        if (suffix) {
+            if (!strcmp(suffix, "c")) {
+                language = "c";
+            } else if (!strcmp(suffix, "m")) {
+                language = "objective-c";
+            } else if (!strcmp(suffix, "mm")) {
+                language = "objective-c++";
+            }
+        }
+        const List<String> args = { "-x", language, "-fsyntax-only", "-w", "-nostdinc", "-nostdinc++" };
+        CXUnsavedFile unsaved = { mPath.constData(), mContents.constData(), static_cast<unsigned long>(mContents.size()) };
+        Flags<CXTranslationUnit_Flags> flags = CXTranslationUnit_Incomplete;
+#if CINDEX_VERSION >= CINDEX_VERSION_ENCODE(0, 43)
+        flags |= CXTranslationUnit_SingleFileParse;
+#endif
+        List<std::pair<uint32_t, uint32_t> > tokens;
+        String error;
+        auto tu = RTags::TranslationUnit::create(mPath, args, &unsaved, 1, flags, false);
+        CXFile file = tu->unit ? clang_getFile(tu->unit, mPath.constData()) : 0;
+        if (file) {
+            RTags::tokenize(tu->unit, file, mContents.size(), tokens);
+            debug() << "Tokenized" << mPath << tokens.size() << "tokens in" << sw.elapsed() << "ms";
+        } else {
+            error = "Failed to tokenize " + mPath;
+        }
+        tu.reset();
+        mFinished(std::move(tokens), std::move(error));
+    }
+
+    Signal<std::function<void(List<std::pair<uint32_t, uint32_t> >, String)> > &finished() { return mFinished; }
+private:
+    const Path mPath;
+    String mContents;
+    Signal<std::function<void(List<std::pair<uint32_t, uint32_t> >, String)> > mFinished;
+};
+
+bool Project::hasTokens(uint32_t fileId) const
+{
+    // rp writes an empty record under --lazy-tokens
+    if (mSegments)
+        return mSegments->recordSize(fileId, SegmentedDatabase::Type_Tokens) >= sizeof(uint32_t) * 2;
+    return sourceFilePath(fileId, fileMapName(Tokens)).isFile();
+}
+
+void Project::createTokens(uint32_t fileId, std::function<void(const String &error)> &&callback)
+{
+    TokenizeThread *thread = new TokenizeThread(Location::path(fileId), unsavedFile(fileId));
+    thread->setAutoDelete(true);
+    std::weak_ptr<Project> weak = shared_from_this();
+    thread->finished().connect<EventLoop::Move>([weak, fileId, callback](const List<std::pair<uint32_t, uint32_t> > &tokens, String error) {
+            std::shared_ptr<Project> project = weak.lock();
+            if (!project) {
+                callback("Project was unloaded");
+                return;
+            }
+            if (error.isEmpty()) {
+                if (project->mSegments) {
+                    List<SegmentedDatabase::Record> records;
+                    records.append({ fileId, SegmentedDatabase::Type_Tokens, FileMap<uint32_t, uint32_t>::encode(tokens) });
+                    if (SegmentedDatabase::append(project->mSegments->path(), records, Rct::currentTimeMs(), &error))
+                        project->mSegments->refresh(&error);
+                } else if (!FileMap<uint32_t, uint32_t>::write(project->sourceFilePath(fileId, fileMapName(Tokens)),
+                                                               tokens, project->fileMapOptions())) {
+                    error = "Failed to write tokens for " + Location::path(fileId);
+                }
+            }
+            callback(error);
+        });
+    thread->start();
+}
+
 bool Project::validate(uint32_t fileId, ValidateMode mode, String *err) const
 {
+    if (mSegments) {
+        for (auto type : { Symbols, SymbolNames, SymbolNameSuffixes, Targets, Usrs }) {
+            if (!mSegments->contains(fileId, recordType(type))) {
+                Log(err) << "Error during validation:" << Location::path(fileId) << fileMapName(type) << "missing from" << mSegments->path();
+                return false;
+            }
+            if (mode == Validate) {
+                String error;
+                if (!mSegments->fileMap<String, Set<Location> >(fileId, recordType(type), &error)) {
+                    Log(err) << "Error during validation:" << Location::path(fileId) << error;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
     if (mode == Validate) {
         Path path;
         String error;
         const uint32_t opts = fileMapOptions();
+        UnitManifest manifest;
+        path = sourceFilePath(fileId, UnitManifest::fileName());
+        if (!manifest.load(path, &error))
+            goto error;
         {
             path = sourceFilePath(fileId, fileMapName(SymbolNames));
             FileMap<String, Set<Location> > fileMap;
             if (!fileMap.load(path, opts, &error))
                 goto error;
+            if (fileMap.count() != manifest.entry(fileMapName(SymbolNames)).count)
+                goto countMismatch;
+        }
+        {
+            path = sourceFilePath(fileId, fileMapName(SymbolNameSuffixes));
+            FileMap<uint32_t, uint64_t> fileMap;
+            if (!fileMap.load(path, opts, &error))
+                goto error;
+            if (fileMap.count() != manifest.entry(fileMapName(SymbolNameSuffixes)).count)
+                goto countMismatch;
         }
         {
             path = sourceFilePath(fileId, fileMapName(Symbols));
             FileMap<Location, Symbol> fileMap;
             if (!fileMap.load(path, opts, &error))
                 goto error;
+            if (fileMap.count() != manifest.entry(fileMapName(Symbols)).count)
+                goto countMismatch;
         }
         {
             path = sourceFilePath(fileId, fileMapName(Targets));
             FileMap<String, Set<Location> > fileMap;
             if (!fileMap.load(path, opts, &error))
                 goto error;
+            if (fileMap.count() != manifest.entry(fileMapName(Targets)).count)
+                goto countMismatch;
         }
         {
             path = sourceFilePath(fileId, fileMapName(Usrs));
             FileMap<String, Set<Location> > fileMap;
             if (!fileMap.load(path, opts, &error))
                 goto error;
+            if (fileMap.count() != manifest.entry(fileMapName(Usrs)).count)
+                goto countMismatch;
         }
         return true;
+  countMismatch:
+        error = "Doesn't match the manifest";
   error:
         if (err)
             Log(err) << "Error during validation:" << Location::path(fileId) << error << path;
         return false;
     } else {
         assert(mode == StatOnly);
-        for (auto type : { Symbols, SymbolNames, Targets, Usrs }) {
+        for (auto type : { Symbols, SymbolNames, SymbolNameSuffixes, Targets, Usrs }) {
             const Path p = sourceFilePath(fileId, fileMapName(type));
             if (!p.isFile()) {
                 Log(err) << "Error during validation:" << Location::path(fileId) << p << "doesn't exist";
@@ -2162,6 +2348,32 @@ bool Project::validate(uint32_t fileId, ValidateMode mode, String *err) const
     return true;
 }
 
+bool Project::validateManifest(uint32_t fileId, uint64_t generation, String *err) const
+{
+    if (mSegments) {
+        // records are appended all at once
+        return validate(fileId, StatOnly, err);
+    }
+    UnitManifest manifest;
+    String error;
+    if (!manifest.load(sourceFilePath(fileId, UnitManifest::fileName()), &error)) {
+        Log(err) << "Error during validation:" << Location::path(fileId) << error;
+        return false;
+    }
+    if (manifest.generation() != generation) {
+        Log(err) << "Error during validation:" << Location::path(fileId) << "manifest generation"
+                 << manifest.generation() << "expected" << generation;
+        return false;
+    }
+    for (auto type : { Symbols, SymbolNames, SymbolNameSuffixes, Targets, Usrs }) {
+        if (!manifest.contains(fileMapName(type))) {
+            Log(err) << "Error during validation:" << Location::path(fileId) << fileMapName(type) << "missing from manifest";
+            return false;
+        }
+    }
+    return true;
+}
+
 template <typename T>
 static inline String toString(const T &t, size_t &max)
 {
@@ -2890,7 +3102,11 @@ void Project::removeSource(uint32_t fileId)
     dirty(fileId);
     releaseFileIds(file);
     removeDependencies(fileId);
-    Path::rmdir(sourceFilePath(fileId));
+    if (mSegments) {
+        mSegments->remove(fileId);
+    } else {
+        Path::rmdir(sourceFilePath(fileId));
+    }
 }
 
 void Project::validateAll()
@@ -33,6 +33,7 @@
 #include "rct/Timer.h"
 #include "rct/Serializer.h"
 #include "RTags.h"
+#include "SegmentedDatabase.h"
 #include "Token.h"
 
 class Connection;
@@ -84,7 +85,8 @@ public:
         SymbolNames,
         Targets,
         Usrs,
-        Tokens
+        Tokens,
+        SymbolNameSuffixes
     };
     static const char *fileMapName(FileMapType type)
     {
@@ -94,9 +96,22 @@ public:
         case Targets: return "targets";
         case Usrs: return "usrs";
         case Tokens: return "tokens";
+        case SymbolNameSuffixes: return "symsuffixes";
         }
         return 0;
     }
+    static SegmentedDatabase::RecordType recordType(FileMapType type)
+    {
+        switch (type) {
+        case Symbols: return SegmentedDatabase::Type_Symbols;
+        case SymbolNames: return SegmentedDatabase::Type_SymbolNames;
+        case Targets: return SegmentedDatabase::Type_Targets;
+        case Usrs: return SegmentedDatabase::Type_Usrs;
+        case Tokens: return SegmentedDatabase::Type_Tokens;
+        case SymbolNameSuffixes: return SegmentedDatabase::Type_SymbolNameSuffixes;
+        }
+        return SegmentedDatabase::Type_Symbols;
+    }
     std::shared_ptr<FileMap<String, Set<Location> > > openSymbolNames(uint32_t fileId, String *err = 0)
     {
         assert(mFileMapScope);
@@ -118,10 +133,23 @@ public:
         return mFileMapScope->openFileMap<String, Set<Location> >(Usrs, fileId, mFileMapScope->usrs, err);
     }
 
-    std::shared_ptr<FileMap<uint32_t, Token> > openTokens(uint32_t fileId, String *err = 0)
+    // See Token.h
+    std::shared_ptr<FileMap<uint32_t, uint32_t> > openTokens(uint32_t fileId, String *err = 0)
+    {
+        assert(mFileMapScope);
+        return mFileMapScope->openFileMap<uint32_t, uint32_t>(Tokens, fileId, mFileMapScope->tokens, err);
+    }
+    // For --lazy-tokens rdm tokenizes files itself, on a thread. The
+    // callback is called on the main thread once the tokens are stored,
+    // with an empty error on success.
+    bool hasTokens(uint32_t fileId) const;
+    void createTokens(uint32_t fileId, std::function<void(const String &error)> &&callback);
+
+    // See SymbolNameSuffix.h
+    std::shared_ptr<FileMap<uint32_t, uint64_t> > openSymbolNameSuffixes(uint32_t fileId, String *err = 0)
     {
         assert(mFileMapScope);
-        return mFileMapScope->openFileMap<uint32_t, Token>(Tokens, fileId, mFileMapScope->tokens, err);
+        return mFileMapScope->openFileMap<uint32_t, uint64_t>(SymbolNameSuffixes, fileId, mFileMapScope->symbolNameSuffixes, err);
     }
 
 
@@ -174,6 +202,8 @@ public:
     Set<Symbol> findByUsr(const String &usr, uint32_t fileId, DependencyMode mode);
 
     Path sourceFilePath(uint32_t fileId, const char *path = "") const;
+    String unsavedFile(uint32_t fileId) const;
+    const std::unique_ptr<SegmentedDatabase> &segments() const { return mSegments; }
 
     List<RTags::SortedSymbol> sort(const Set<Symbol> &symbols,
                                    Flags<QueryMessage::Flag> flags = Flags<QueryMessage::Flag>());
@@ -284,6 +314,9 @@ private:
         Validate
     };
     bool validate(uint32_t fileId, ValidateMode mode, String *error = 0) const;
+    // Only reads the manifest rp wrote after the maps, generation is
+    // UnitManifest::generation() of the job that should have written it
+    bool validateManifest(uint32_t fileId, uint64_t generation, String *error = 0) const;
     void removeDependencies(uint32_t fileId);
     void updateDependencies(uint32_t fileId, const std::shared_ptr<IndexDataMessage> &msg);
     void loadFailed(uint32_t fileId);
@@ -343,9 +376,16 @@ private:
                 return it->second;
             }
             const Path path = project->sourceFilePath(fileId, Project::fileMapName(type));
-            auto fileMap = std::make_shared<FileMap<Key, Value>>();
+            std::shared_ptr<FileMap<Key, Value> > fileMap;
             String err;
-            if (fileMap->load(path, project->fileMapOptions(), &err)) {
+            if (project->mSegments) {
+                fileMap = project->mSegments->fileMap<Key, Value>(fileId, Project::recordType(type), &err);
+            } else {
+                fileMap = std::make_shared<FileMap<Key, Value>>();
+                if (!fileMap->load(path, project->fileMapOptions(), &err))
+                    fileMap.reset();
+            }
+            if (fileMap) {
                 ++totalOpened;
                 cache[fileId] = fileMap;
                 auto entry = std::make_shared<LRUEntry>(type, fileId);
@@ -376,6 +416,10 @@ private:
                         assert(tokens.contains(e->key.fileId));
                         tokens.remove(e->key.fileId);
                         break;
+                    case SymbolNameSuffixes:
+                        assert(symbolNameSuffixes.contains(e->key.fileId));
+                        symbolNameSuffixes.remove(e->key.fileId);
+                        break;
                     }
                     --openedFiles;
                 }
@@ -387,7 +431,6 @@ private:
                     error() << "Failed to open" << path << Location::path(fileId) << err;
                 }
                 loadFailed = true;
-                fileMap.reset();
             }
             return fileMap;
         }
@@ -395,7 +438,8 @@ private:
         Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > symbolNames;
         Hash<uint32_t, std::shared_ptr<FileMap<Location, Symbol> > > symbols;
         Hash<uint32_t, std::shared_ptr<FileMap<String, Set<Location> > > > targets, usrs;
-        Hash<uint32_t, std::shared_ptr<FileMap<uint32_t, Token> > > tokens;
+        Hash<uint32_t, std::shared_ptr<FileMap<uint32_t, uint32_t> > > tokens;
+        Hash<uint32_t, std::shared_ptr<FileMap<uint32_t, uint64_t> > > symbolNameSuffixes;
         std::shared_ptr<Project> project;
         int openedFiles, totalOpened;
         const int max;
@@ -406,6 +450,7 @@ private:
     };
 
     std::shared_ptr<FileMapScope> mFileMapScope;
+    std::unique_ptr<SegmentedDatabase> mSegments;
 
     const Path mPath, mProjectDataDir;
     Path mProjectFilePath, mSourcesFilePath;
@@ -474,4 +519,11 @@ inline Path Project::sourceFilePath(uint32_t fileId, const char *type) const
     return String::format<1024>("%s%d/%s", mProjectDataDir.constData(), fileId, type);
 }
 
+inline String Project::unsavedFile(uint32_t fileId) const
+{
+    if (mSegments)
+        return mSegments->record(fileId, SegmentedDatabase::Type_Unsaved);
+    return sourceFilePath(fileId, "unsaved").readAll();
+}
+
 #endif
@@ -27,7 +27,7 @@ void QueryMessage::encode(Serializer &serializer) const
 {
     serializer << mCommandLine << mQuery << mCodeCompletePrefix << mType << mFlags << mMax
                << mMinLine << mMaxLine << mBuildIndex << mPathFilters << mKindFilters
-               << mCurrentFile << mUnsavedFiles << mTerminalWidth
+               << mCurrentFile << mUnsavedFiles << mUnsavedFileVersions << mUnsavedFileEdits << mTerminalWidth
 #ifdef RTAGS_HAS_LUA
                << mVisitASTScripts
 #endif
@@ -38,7 +38,7 @@ void QueryMessage::decode(Deserializer &deserializer)
 {
     deserializer >> mCommandLine >> mQuery >> mCodeCompletePrefix >> mType >> mFlags >> mMax
                  >> mMinLine >> mMaxLine >> mBuildIndex >> mPathFilters >> mKindFilters
-                 >> mCurrentFile >> mUnsavedFiles >> mTerminalWidth
+                 >> mCurrentFile >> mUnsavedFiles >> mUnsavedFileVersions >> mUnsavedFileEdits >> mTerminalWidth
 #ifdef RTAGS_HAS_LUA
                  >> mVisitASTScripts
 #endif
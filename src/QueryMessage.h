@@ -184,6 +184,24 @@ public:
 
     void setUnsavedFiles(const UnsavedFiles &unsavedFiles) { mUnsavedFiles = unsavedFiles; }
     const UnsavedFiles &unsavedFiles() const { return mUnsavedFiles; }
+    void setUnsavedFile(const Path &path, const String &contents) { mUnsavedFiles[path] = contents; }
+
+    // The client's version of the contents in unsavedFiles, rdm keeps
+    // versioned buffers around so later queries can send edits instead.
+    void setUnsavedFileVersions(const Hash<Path, uint64_t> &versions) { mUnsavedFileVersions = versions; }
+    const Hash<Path, uint64_t> &unsavedFileVersions() const { return mUnsavedFileVersions; }
+
+    // Replaces removed bytes at offset with text in version base of the
+    // buffer rdm has, giving version. An edit that replaces nothing just
+    // refers to a version rdm already has.
+    struct UnsavedFileEdit {
+        uint64_t base, version;
+        uint32_t offset, removed;
+        String text;
+    };
+    typedef Hash<Path, List<UnsavedFileEdit> > UnsavedFileEdits;
+    void setUnsavedFileEdits(const UnsavedFileEdits &edits) { mUnsavedFileEdits = edits; }
+    const UnsavedFileEdits &unsavedFileEdits() const { return mUnsavedFileEdits; }
 
     String query() const { return mQuery; }
     Location location(Location::DecodeFlag flag = Location::NoDecodeFlag) const
@@ -251,6 +269,8 @@ private:
     KindFilters mKindFilters;
     Path mCurrentFile;
     UnsavedFiles mUnsavedFiles;
+    Hash<Path, uint64_t> mUnsavedFileVersions;
+    UnsavedFileEdits mUnsavedFileEdits;
     int mTerminalWidth;
 #ifdef RTAGS_HAS_LUA
     List<String> mVisitASTScripts;
@@ -262,6 +282,18 @@ RCT_FLAGS(QueryMessage::Flag);
 RCT_FLAGS(QueryMessage::KindFilters::DefinitionType);
 RCT_FLAGS(QueryMessage::KindFilters::Flag);
 
+inline Serializer &operator<<(Serializer &s, const QueryMessage::UnsavedFileEdit &edit)
+{
+    s << edit.base << edit.version << edit.offset << edit.removed << edit.text;
+    return s;
+}
+
+inline Deserializer &operator>>(Deserializer &s, QueryMessage::UnsavedFileEdit &edit)
+{
+    s >> edit.base >> edit.version >> edit.offset >> edit.removed >> edit.text;
+    return s;
+}
+
 inline Serializer &operator<<(Serializer &s, const QueryMessage::PathFilter &filter)
 {
     s << filter.pattern << static_cast<uint8_t>(filter.mode);
@@ -15,8 +15,12 @@
 
 #include "RClient.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 
 #include "FileMap.h"
 #include "IndexMessage.h"
@@ -27,6 +31,7 @@
 #include "rct/QuitMessage.h"
 #include "rct/Rct.h"
 #include "rct/StopWatch.h"
+#include "rct/Timer.h"
 #include "rct/OnDestruction.h"
 #include "RTags.h"
 #include "RTagsLogOutput.h"
@@ -49,6 +54,7 @@ std::initializer_list<CommandLineParser::Option<RClient::OptionType> > opts = {
     { RClient::None, String(), 0, CommandLineParser::NoValue, "Rdm:" },
     { RClient::QuitRdm, "quit-rdm", 'q', CommandLineParser::NoValue, "Tell server to shut down with optional exit code as argument." },
     { RClient::ConnectTimeout, "connect-timeout", 0, CommandLineParser::Required, "Timeout for connecting to rdm in ms (default " STR(DEFAULT_CONNECT_TIMEOUT)  ")." },
+    { RClient::StdioServer, "stdio-server", 0, CommandLineParser::NoValue, "Keep running and read rc commands from stdin, see StdioServer in RClient.cpp for the framing." },
 
     { RClient::None, String(), 0, CommandLineParser::NoValue, "" },
     { RClient::None, String(), 0, CommandLineParser::NoValue, "Project management:" },
@@ -121,6 +127,8 @@ std::initializer_list<CommandLineParser::Option<RClient::OptionType> > opts = {
     { RClient::ReverseSort, "reverse-sort", 'O', CommandLineParser::NoValue, "Sort output reversed." },
     { RClient::Rename, "rename", 0, CommandLineParser::NoValue, "Used for --references to indicate that we're using the results to rename symbols." },
     { RClient::UnsavedFile, "unsaved-file", 0, CommandLineParser::Required, "Pass unsaved file on command line. E.g. --unsaved-file=main.cpp:1200 then write 1200 bytes on stdin." },
+    { RClient::UnsavedFileVersion, "unsaved-file-version", 0, CommandLineParser::Required, "Version of an unsaved file passed with --unsaved-file, rdm keeps it so later commands can use --unsaved-file-edit. E.g. --unsaved-file-version=main.cpp:12." },
+    { RClient::UnsavedFileEdit, "unsaved-file-edit", 0, CommandLineParser::Required, "Edit the version of an unsaved file rdm has. E.g. --unsaved-file-edit=main.cpp:12:13:100:5:3 replaces 5 bytes at offset 100 in version 12 with 3 bytes from stdin, giving version 13. main.cpp:12:12:0:0:0 uses version 12 as it is." },
     { RClient::LogFile, "log-file", 'L', CommandLineParser::Required, "Log to this file." },
     { RClient::NoContext, "no-context", 'N', CommandLineParser::NoValue, "Don't print context for locations." },
     { RClient::PathFilter, "path-filter", 'i', CommandLineParser::Required, "Filter out results not matching with arg." },
@@ -206,7 +214,7 @@ public:
     {
 #ifndef HAS_JSON_H
         if (type == QueryMessage::CodeCompleteAt && rc->queryFlags() & QueryMessage::JSON) {
-            fprintf(stdout, "{\"error\": \"JSON output for completions is not supported with this compiler\"}\n");
+            rc->writeOutput("{\"error\": \"JSON output for completions is not supported with this compiler\"}");
             return RTags::ArgumentParseError;
         }
 #endif
@@ -215,6 +223,8 @@ public:
         msg.setQuery(std::move(query));
         msg.setBuildIndex(rc->buildIndex());
         msg.setUnsavedFiles(rc->unsavedFiles());
+        msg.setUnsavedFileVersions(rc->unsavedFileVersions());
+        msg.setUnsavedFileEdits(rc->unsavedFileEdits());
         msg.setFlags(extraQueryFlags | rc->queryFlags());
         msg.setMax(rc->max());
         msg.setPathFilters(rc->pathFilters());
@@ -324,11 +334,326 @@ public:
     }
 };
 
+// rc --stdio-server reads requests from stdin and writes their output to
+// stdout so an editor can keep one rc running instead of starting one per
+// query. Requests run concurrently, each on its own connection to rdm.
+// Connections go back to a pool when their request is done so the next
+// request doesn't have to connect either.
+//
+// request:  "<id> <argument bytes> <input bytes>\n" followed by the rc
+//           arguments, each one terminated by '\0', and the input that
+//           --unsaved-file and friends read instead of stdin
+// cancel:   "<id> cancel\n"
+// response: "<id> <exit code> <output bytes>\n" followed by the output
+//
+// Responses come in the order requests finish. Options that print
+// something themselves (--help, --version) are rejected. On EOF the
+// requests already read still get their responses before rc exits.
+class StdioServer
+{
+public:
+    StdioServer(RClient *rc)
+        : mRC(rc), mEOF(false)
+    {}
+
+    enum { MaxIdleConnections = 8 };
+
+    int exec()
+    {
+        // stdin stays blocking, on a pty it shares its file description with
+        // stdout and we don't want our writes to become non-blocking
+        EventLoop::SharedPtr loop = EventLoop::eventLoop();
+        loop->registerSocket(STDIN_FILENO, EventLoop::SocketRead, std::bind(&StdioServer::onStdin, this));
+        loop->exec();
+        if (!mEOF)
+            loop->unregisterSocket(STDIN_FILENO);
+        for (const auto &connection : mIdle) {
+            if (connection->client())
+                connection->client()->close();
+        }
+        return RTags::Success;
+    }
+private:
+    struct Request {
+        Request()
+            : command(0), exitCode(RTags::Success)
+        {}
+
+        String id, input, output;
+        RClient client;
+        size_t command;
+        int exitCode;
+        std::shared_ptr<Connection> connection;
+    };
+
+    void onStdin()
+    {
+        // one read per wakeup, the loop told us this one won't block
+        char buf[16384];
+        const ssize_t r = ::read(STDIN_FILENO, buf, sizeof(buf));
+        if (r > 0) {
+            mBuffer.append(buf, r);
+        } else if (r == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else {
+            // the editor is done sending, it still wants its responses
+            mEOF = true;
+            EventLoop::eventLoop()->unregisterSocket(STDIN_FILENO);
+            quitIfDone();
+            return;
+        }
+
+        while (true) {
+            const int newline = mBuffer.indexOf('\n');
+            if (newline == -1)
+                return;
+            const List<String> header = mBuffer.left(newline).split(' ');
+            if (header.size() == 2 && header.at(1) == "cancel") {
+                mBuffer.remove(0, newline + 1);
+                cancel(header.at(0));
+                continue;
+            }
+            if (header.size() != 3) {
+                write(header.value(0), RTags::ProtocolFailure, "Can't parse request " + mBuffer.left(newline));
+                mBuffer.remove(0, newline + 1);
+                continue;
+            }
+            const size_t argumentBytes = strtoull(header.at(1).constData(), 0, 10);
+            const size_t inputBytes = strtoull(header.at(2).constData(), 0, 10);
+            if (mBuffer.size() < newline + 1 + argumentBytes + inputBytes)
+                return; // wait for the rest
+            const String arguments = mBuffer.mid(newline + 1, argumentBytes);
+            String input = mBuffer.mid(newline + 1 + argumentBytes, inputBytes);
+            mBuffer.remove(0, newline + 1 + argumentBytes + inputBytes);
+            start(header.at(0), arguments, std::move(input));
+        }
+    }
+
+    void start(const String &id, const String &arguments, String &&input)
+    {
+        if (mRequests.contains(id)) {
+            write(id, RTags::ProtocolFailure, "Duplicate request id " + id);
+            return;
+        }
+
+        auto request = std::make_shared<Request>();
+        request->id = id;
+        request->input = std::move(input);
+        RClient &client = request->client;
+        client.mStdioRequest = true;
+        client.mOutput = &request->output;
+
+        List<String> args;
+        args.append(Rct::executablePath());
+        size_t last = 0;
+        for (size_t i=0; i<arguments.size(); ++i) {
+            if (!arguments.at(i)) {
+                args.append(arguments.mid(last, i - last));
+                last = i + 1;
+            }
+        }
+        if (last < arguments.size())
+            args.append(arguments.mid(last));
+        List<char *> argv(args.size());
+        for (size_t i=0; i<args.size(); ++i)
+            argv[i] = args[i].data();
+
+        FILE *f = (request->input.isEmpty()
+                   ? fopen("/dev/null", "r")
+                   : fmemopen(request->input.data(), request->input.size(), "r"));
+        client.mInput = f;
+        const CommandLineParser::ParseStatus status = client.parse(argv.size(), argv.data());
+        client.mInput = 0;
+        if (f)
+            fclose(f);
+        request->input.clear();
+
+        switch (status.status) {
+        case CommandLineParser::Parse_Error:
+            request->output << status.error << '\n';
+            write(id, client.exitCode(), request->output);
+            break;
+        case CommandLineParser::Parse_Ok:
+            write(id, client.exitCode(), request->output);
+            break;
+        case CommandLineParser::Parse_Exec:
+            mRequests[id] = request;
+            next(request);
+            break;
+        }
+    }
+
+    void next(const std::shared_ptr<Request> &request)
+    {
+        RClient &client = request->client;
+        if (request->command == client.mCommands.size()) {
+            finish(request, request->exitCode);
+            return;
+        }
+        if (!request->connection) {
+            String error;
+            request->connection = connection(&error);
+            if (!request->connection) {
+                request->output << error << '\n';
+                finish(request, RTags::ConnectionFailure);
+                return;
+            }
+            mActive[request->connection.get()] = request;
+            if (!request->connection->isConnected())
+                return; // tcp, we're called again once it's connected
+        }
+        const std::shared_ptr<RCCommand> &cmd = client.mCommands.at(request->command++);
+        debug() << "running command " << cmd->description() << "for" << request->id;
+        const RTags::ExitCode exitCode = cmd->exec(&client, request->connection);
+        if (exitCode != RTags::Success)
+            finish(request, exitCode);
+    }
+
+    void finish(const std::shared_ptr<Request> &request, int exitCode)
+    {
+        mRequests.remove(request->id);
+        if (request->connection) {
+            mActive.remove(request->connection.get());
+            if (request->connection->isConnected() && mIdle.size() < MaxIdleConnections) {
+                mIdle.append(request->connection);
+            } else if (request->connection->client()) {
+                request->connection->client()->close();
+            }
+            request->connection.reset();
+        }
+        write(request->id, exitCode, request->output);
+        quitIfDone();
+    }
+
+    void cancel(const String &id)
+    {
+        const std::shared_ptr<Request> request = mRequests.value(id);
+        if (!request)
+            return;
+        mRequests.remove(id);
+        if (request->connection) {
+            // rdm may still be writing to this one, don't reuse it
+            mActive.remove(request->connection.get());
+            if (request->connection->client())
+                request->connection->client()->close();
+            request->connection.reset();
+        }
+        write(id, RTags::Cancelled, String());
+        quitIfDone();
+    }
+
+    void quitIfDone()
+    {
+        if (mEOF && mRequests.isEmpty())
+            EventLoop::eventLoop()->quit();
+    }
+
+    std::shared_ptr<Connection> connection(String *error)
+    {
+        while (!mIdle.isEmpty()) {
+            std::shared_ptr<Connection> connection = mIdle.takeLast();
+            if (connection->isConnected())
+                return connection;
+        }
+
+        // a nested event loop would hold up every other request
+        std::shared_ptr<Connection> connection = mRC->connect(RClient::ConnectInBackground, error);
+        if (!connection)
+            return connection;
+        std::weak_ptr<Connection> weak = connection;
+        if (!connection->isConnected()) {
+            connection->connected().connect(std::bind([this, weak]() {
+                        const std::shared_ptr<Connection> conn = weak.lock();
+                        if (!conn)
+                            return;
+                        if (const std::shared_ptr<Request> request = mActive.value(conn.get()))
+                            next(request);
+                    }));
+            if (mRC->mConnectTimeout > 0) {
+                EventLoop::eventLoop()->registerTimer([this, weak](int) {
+                        const std::shared_ptr<Connection> conn = weak.lock();
+                        if (!conn || conn->isConnected())
+                            return;
+                        if (const std::shared_ptr<Request> request = mActive.value(conn.get())) {
+                            mActive.remove(conn.get());
+                            request->connection.reset();
+                            request->output << String::format<128>("Can't seem to connect to server (%s:%d)\n",
+                                                                   mRC->mTcpHost.constData(), mRC->mTcpPort);
+                            finish(request, RTags::ConnectionFailure);
+                        }
+                        if (conn->client())
+                            conn->client()->close();
+                    }, mRC->mConnectTimeout, Timer::SingleShot);
+            }
+        }
+        connection->newMessage().connect([this](const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &conn) {
+                if (const std::shared_ptr<Request> request = mActive.value(conn.get()))
+                    request->client.onNewMessage(message, conn);
+            });
+        connection->finished().connect(std::bind([this, weak]() {
+                    const std::shared_ptr<Connection> conn = weak.lock();
+                    if (!conn)
+                        return;
+                    if (const std::shared_ptr<Request> request = mActive.value(conn.get())) {
+                        request->exitCode = conn->finishStatus();
+                        next(request);
+                    }
+                }));
+        connection->disconnected().connect(std::bind([this, weak]() {
+                    const std::shared_ptr<Connection> conn = weak.lock();
+                    if (!conn)
+                        return;
+                    auto it = std::find(mIdle.begin(), mIdle.end(), conn);
+                    if (it != mIdle.end())
+                        mIdle.erase(it);
+                    if (const std::shared_ptr<Request> request = mActive.value(conn.get())) {
+                        mActive.remove(conn.get());
+                        request->connection.reset();
+                        finish(request, RTags::NetworkFailure);
+                    }
+                }));
+        return connection;
+    }
+
+    void write(const String &id, int exitCode, const String &output)
+    {
+        const String header = String::format<128>("%s %d %zu\n", id.constData(), exitCode, output.size());
+        writeAll(header.constData(), header.size());
+        writeAll(output.constData(), output.size());
+    }
+
+    // The editor may have made stdout non-blocking, a frame must never be
+    // cut short
+    static void writeAll(const char *data, size_t size)
+    {
+        while (size) {
+            const ssize_t w = ::write(STDOUT_FILENO, data, size);
+            if (w > 0) {
+                data += w;
+                size -= w;
+            } else if (w == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pollfd pfd = { STDOUT_FILENO, POLLOUT, 0 };
+                poll(&pfd, 1, -1);
+            } else if (w == -1 && errno != EINTR) {
+                return;
+            }
+        }
+    }
+
+    RClient *mRC;
+    String mBuffer;
+    Hash<String, std::shared_ptr<Request> > mRequests;
+    Hash<Connection *, std::shared_ptr<Request> > mActive;
+    List<std::shared_ptr<Connection> > mIdle;
+    bool mEOF;
+};
+
 RClient::RClient()
     : mMax(-1), mTimeout(-1), mMinOffset(-1), mMaxOffset(-1),
       mConnectTimeout(DEFAULT_CONNECT_TIMEOUT), mBuildIndex(0),
       mLogLevel(LogLevel::Error), mTcpPort(0), mGuessFlags(false),
-      mTerminalWidth(-1), mExitCode(RTags::ArgumentParseError)
+      mTerminalWidth(-1), mExitCode(RTags::ArgumentParseError), mInput(stdin), mOutput(0),
+      mStdioServer(false), mStdioRequest(false)
 {
     struct winsize w;
     ioctl(0, TIOCGWINSZ, &w);
@@ -339,7 +664,8 @@ RClient::RClient()
 
 RClient::~RClient()
 {
-    cleanupLogging();
+    if (!mStdioRequest)
+        cleanupLogging();
 }
 
 void RClient::addQuery(QueryMessage::Type type, String &&query, Flags<QueryMessage::Flag> extraQueryFlags)
@@ -370,6 +696,35 @@ void RClient::addCompile(Path &&path)
     mCommands.append(std::make_shared<CompileCommand>(std::move(path)));
 }
 
+std::shared_ptr<Connection> RClient::connect(ConnectMode mode, String *error)
+{
+    auto fail = [this, error](const String &message) {
+        if (error) {
+            *error = message;
+        } else if (mLogLevel >= LogLevel::Error) {
+            fprintf(stdout, "%s\n", message.constData());
+        }
+        mExitCode = RTags::ConnectionFailure;
+        return std::shared_ptr<Connection>();
+    };
+    std::shared_ptr<Connection> connection = Connection::create(NumOptions);
+    if (mTcpPort) {
+        const String message = String::format<128>("Can't seem to connect to server (%s:%d)", mTcpHost.constData(), mTcpPort);
+        if (!connection->connectTcp(mTcpHost, mTcpPort, mConnectTimeout))
+            return fail(message);
+        if (mode == ConnectInBackground)
+            return connection;
+        EventLoop::SharedPtr loop = EventLoop::eventLoop();
+        connection->connected().connect(std::bind(&EventLoop::quit, loop.get()));
+        loop->exec(mConnectTimeout);
+        if (!connection->isConnected())
+            return fail(message);
+    } else if (!connection->connectUnix(mSocketFile, mConnectTimeout)) {
+        return fail(String::format<128>("Can't seem to connect to server (%s)", mSocketFile.constData()));
+    }
+    return connection;
+}
+
 void RClient::exec()
 {
     RTags::initMessages();
@@ -377,38 +732,20 @@ void RClient::exec()
     EventLoop::SharedPtr loop(new EventLoop);
     loop->init(EventLoop::MainEventLoop);
 
+    if (mStdioServer) {
+        ::StdioServer server(this);
+        mExitCode = server.exec();
+        return;
+    }
+
     const int commandCount = mCommands.size();
-    std::shared_ptr<Connection> connection = Connection::create(NumOptions);
+    std::shared_ptr<Connection> connection = connect();
+    if (!connection)
+        return;
     connection->newMessage().connect(std::bind(&RClient::onNewMessage, this,
                                                std::placeholders::_1, std::placeholders::_2));
     connection->finished().connect(std::bind([](){ EventLoop::eventLoop()->quit(); }));
     connection->disconnected().connect(std::bind([](){ EventLoop::eventLoop()->quit(); }));
-    if (mTcpPort) {
-        if (!connection->connectTcp(mTcpHost, mTcpPort, mConnectTimeout)) {
-            if (mLogLevel >= LogLevel::Error)
-                fprintf(stdout, "Can't seem to connect to server (%s:%d)\n", mTcpHost.constData(), mTcpPort);
-            mExitCode = RTags::ConnectionFailure;
-            return;
-        }
-        connection->connected().connect(std::bind(&EventLoop::quit, loop.get()));
-        loop->exec(mConnectTimeout);
-        if (!connection->isConnected()) {
-            if (mLogLevel >= LogLevel::Error) {
-                if (mTcpPort) {
-                    fprintf(stdout, "Can't seem to connect to server (%s:%d)\n", mTcpHost.constData(), mTcpPort);
-                } else {
-                    fprintf(stdout, "Can't seem to connect to server (%s)\n", mSocketFile.constData());
-                }
-            }
-            mExitCode = RTags::ConnectionFailure;
-            return;
-        }
-    } else if (!connection->connectUnix(mSocketFile, mConnectTimeout)) {
-        if (mLogLevel >= LogLevel::Error)
-            fprintf(stdout, "Can't seem to connect to server (%s)\n", mSocketFile.constData());
-        mExitCode = RTags::ConnectionFailure;
-        return;
-    }
 
     for (int i=0; i<commandCount; ++i) {
         const std::shared_ptr<RCCommand> &cmd = mCommands.at(i);
@@ -464,10 +801,14 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             Path::setRealPathEnabled(false);
             break; }
         case Help: {
+            if (mStdioRequest)
+                return { String::format<1024>("--help isn't supported in --stdio-server requests"), CommandLineParser::Parse_Error };
             CommandLineParser::help(stdout, "rc", opts);
             mExitCode = RTags::Success;
             return { String(), CommandLineParser::Parse_Ok } ; }
         case Man: {
+            if (mStdioRequest)
+                return { String::format<1024>("--man isn't supported in --stdio-server requests"), CommandLineParser::Parse_Error };
             CommandLineParser::man(opts);
             mExitCode = RTags::Success;
             return { String(), CommandLineParser::Parse_Ok }; }
@@ -639,10 +980,14 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             addQuery(QueryMessage::Validate);
             break; }
         case Version: {
+            if (mStdioRequest)
+                return { String::format<1024>("--version isn't supported in --stdio-server requests"), CommandLineParser::Parse_Error };
             fprintf(stdout, "%s\n", RTags::versionString().constData());
             mExitCode = RTags::Success;
             return { String(), CommandLineParser::Parse_Ok }; }
         case VerifyVersion: {
+            if (mStdioRequest)
+                return { String::format<1024>("--verify-version isn't supported in --stdio-server requests"), CommandLineParser::Parse_Error };
             const int version = strtoul(value.constData(), 0, 10);
             if (version != NumOptions) {
                 fprintf(stdout, "Protocol version mismatch\n");
@@ -689,6 +1034,11 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
                 return { String::format<1024>("--connect-timeout [arg] must be >= 0"), CommandLineParser::Parse_Error };
             }
             break; }
+        case StdioServer: {
+            if (mStdioRequest)
+                return { String::format<1024>("--stdio-server can't be nested"), CommandLineParser::Parse_Error };
+            mStdioServer = true;
+            break; }
         case Max: {
             bool ok;
             mMax = value.toULongLong(&ok);
@@ -723,7 +1073,7 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             }
 
             String contents(bytes, '\0');
-            const int r = fread(contents.data(), 1, bytes, stdin);
+            const int r = fread(contents.data(), 1, bytes, mInput);
             if (r != bytes) {
                 return {
                     String::format<1024>("Read error %d (%s). Got %d, expected %d", errno, Rct::strerror(errno).constData(), r, bytes),
@@ -732,6 +1082,48 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             }
             mUnsavedFiles[path] = contents;
             break; }
+        case UnsavedFileVersion: {
+            const String arg(value);
+            const int colon = arg.lastIndexOf(':');
+            char *end = 0;
+            const uint64_t version = colon == -1 ? 0 : strtoull(arg.constData() + colon + 1, &end, 10);
+            if (colon == -1 || end == arg.constData() + colon + 1 || *end) {
+                return { String::format<1024>("Can't parse --unsaved-file-version [%s]", value.constData()), CommandLineParser::Parse_Error };
+            }
+            mUnsavedFileVersions[arg.left(colon)] = version;
+            break; }
+        case UnsavedFileEdit: {
+            // path:base:version:offset:removed:bytes, the path may have colons
+            String arg(value);
+            uint64_t fields[5];
+            bool ok = true;
+            for (int i=4; i>=0 && ok; --i) {
+                const int colon = arg.lastIndexOf(':');
+                ok = colon != -1;
+                if (ok) {
+                    char *end;
+                    fields[i] = strtoull(arg.constData() + colon + 1, &end, 10);
+                    ok = end != arg.constData() + colon + 1 && !*end;
+                    arg.truncate(colon);
+                }
+            }
+            if (!ok || fields[3] > UINT32_MAX || fields[2] > UINT32_MAX) {
+                return { String::format<1024>("Can't parse --unsaved-file-edit [%s]", value.constData()), CommandLineParser::Parse_Error };
+            }
+            QueryMessage::UnsavedFileEdit edit = { fields[0], fields[1], static_cast<uint32_t>(fields[2]), static_cast<uint32_t>(fields[3]), String() };
+            const size_t bytes = fields[4];
+            if (bytes) {
+                edit.text.resize(bytes);
+                const size_t r = fread(edit.text.data(), 1, bytes, mInput);
+                if (r != bytes) {
+                    return {
+                        String::format<1024>("Read error %d (%s). Got %zu, expected %zu", errno, Rct::strerror(errno).constData(), r, bytes),
+                        CommandLineParser::Parse_Error
+                        };
+                }
+            }
+            mUnsavedFileEdits[arg].append(std::move(edit));
+            break; }
         case FollowLocation:
         case ClassHierarchy:
         case ReferenceLocation: {
@@ -851,20 +1243,20 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             break; }
         case FindProjectRoot: {
             const Path p = Path::resolved(value); // this won't work correctly with --no-realpath unless --no-realpath is passed first
-            printf("findProjectRoot [%s] => [%s]\n", p.constData(), RTags::findProjectRoot(p, RTags::SourceRoot).constData());
+            writeOutput(String::format<1024>("findProjectRoot [%s] => [%s]", p.constData(), RTags::findProjectRoot(p, RTags::SourceRoot).constData()));
             mExitCode = RTags::Success;
             return { String(), CommandLineParser::Parse_Ok }; }
         case FindProjectBuildRoot: {
             const Path p = Path::resolved(value); // this won't work correctly with --no-realpath unless --no-realpath is passed first
-            printf("findProjectRoot [%s] => [%s]\n", p.constData(), RTags::findProjectRoot(p, RTags::BuildRoot).constData());
+            writeOutput(String::format<1024>("findProjectRoot [%s] => [%s]", p.constData(), RTags::findProjectRoot(p, RTags::BuildRoot).constData()));
             mExitCode = RTags::Success;
             return { String(), CommandLineParser::Parse_Ok }; }
         case RTagsConfig: {
             const Path p = Path::resolved(value); // this won't work correctly with --no-realpath unless --no-realpath is passed first
             Map<String, String> config = RTags::rtagsConfig(p);
-            printf("rtags-config: %s:\n", p.constData());
+            writeOutput(String::format<1024>("rtags-config: %s:", p.constData()));
             for (const auto &it : config) {
-                printf("%s: \"%s\"\n", it.first.constData(), it.second.constData());
+                writeOutput(String::format<1024>("%s: \"%s\"", it.first.constData(), it.second.constData()));
             }
             mExitCode = RTags::Success;
             return { String(), CommandLineParser::Parse_Ok }; }
@@ -995,7 +1387,7 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
 
                 if (arg == "-") {
                     char buf[1024];
-                    while (fgets(buf, sizeof(buf), stdin)) {
+                    while (fgets(buf, sizeof(buf), mInput)) {
                         String a(buf);
                         if (a.endsWith('\n'))
                             a.chop(1);
@@ -1117,7 +1509,7 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
             if (args == "-" || args.isEmpty()) {
                 String pending;
                 char buf[16384];
-                while (fgets(buf, sizeof(buf), stdin)) {
+                while (fgets(buf, sizeof(buf), mInput)) {
                     pending += buf;
                     if (!pending.endsWith("\\\n")) {
                         addCompile(std::move(pending), Path::pwd());
@@ -1310,11 +1702,11 @@ CommandLineParser::ParseStatus RClient::parse(size_t argc, char **argv)
     if (ret.status != CommandLineParser::Parse_Exec)
         return ret;
 
-    if (!initLogging(argv[0], logFlags, mLogLevel, logFile)) {
+    if (!mStdioRequest && !initLogging(argv[0], logFlags, mLogLevel, logFile)) {
         return { String::format<1024>("Can't initialize logging with %d %s %s", mLogLevel.toInt(), logFile.constData(), logFlags.toString().constData()), CommandLineParser::Parse_Error };
     }
 
-    if (mCommands.isEmpty()) {
+    if (mCommands.isEmpty() && !mStdioServer) {
         help(stderr, argv[0], opts);
         return { "No commands", CommandLineParser::Parse_Error };
     }
@@ -1346,15 +1738,23 @@ void RClient::onNewMessage(const std::shared_ptr<Message> &message, const std::s
 {
     if (message->messageId() == ResponseMessage::MessageId) {
         const String response = std::static_pointer_cast<ResponseMessage>(message)->data();
-        if (!response.isEmpty() && mLogLevel >= LogLevel::Error) {
-            fprintf(stdout, "%s\n", response.constData());
-            fflush(stdout);
-        }
+        if (!response.isEmpty() && mLogLevel >= LogLevel::Error)
+            writeOutput(response);
     } else {
         error("Unexpected message: %d", message->messageId());
     }
 }
 
+void RClient::writeOutput(const String &line)
+{
+    if (mOutput) {
+        *mOutput << line << '\n';
+    } else {
+        fprintf(stdout, "%s\n", line.constData());
+        fflush(stdout);
+    }
+}
+
 List<String> RClient::environment() const
 {
     if (mEnvironment.isEmpty()) {
@@ -16,6 +16,8 @@
 #ifndef RClient_h
 #define RClient_h
 
+#include <stdio.h>
+
 #include "QueryMessage.h"
 #include "rct/List.h"
 #include "rct/Message.h"
@@ -28,6 +30,7 @@
 class RCCommand;
 class QueryCommand;
 class Connection;
+class StdioServer;
 class RClient
 {
 public:
@@ -133,6 +136,7 @@ public:
         SocketFile,
         Sources,
         Status,
+        StdioServer,
         StripParen,
         Suspend,
         SymbolInfo,
@@ -147,6 +151,8 @@ public:
         Tokens,
         TokensIncludeSymbols,
         UnsavedFile,
+        UnsavedFileEdit,
+        UnsavedFileVersion,
         Validate,
         Verbose,
         VerifyVersion,
@@ -177,6 +183,8 @@ public:
     const QueryMessage::KindFilters &kindFilters() const { return mKindFilters; }
 
     const UnsavedFiles &unsavedFiles() const { return mUnsavedFiles; }
+    const Hash<Path, uint64_t> &unsavedFileVersions() const { return mUnsavedFileVersions; }
+    const QueryMessage::UnsavedFileEdits &unsavedFileEdits() const { return mUnsavedFileEdits; }
 
     const List<String> &rdmArgs() const { return mRdmArgs; }
     const Path &currentFile() const { return mCurrentFile; }
@@ -190,6 +198,8 @@ public:
 
     String commandLine() const { return mCommandLine; }
     void onNewMessage(const std::shared_ptr<Message> &message, const std::shared_ptr<Connection> &);
+    // Writes a line to mOutput if set, stdout otherwise
+    void writeOutput(const String &line);
     List<String> environment() const;
     String codeCompletePrefix() const { return mCodeCompletePrefix; }
 #ifdef RTAGS_HAS_LUA
@@ -203,6 +213,14 @@ private:
     void addLog(LogLevel level);
     void addCompile(String &&args, const Path &cwd);
     void addCompile(Path &&compileCommands);
+    // ConnectInBackground returns a tcp connection before it's connected,
+    // connected() fires when it is. Errors go to error if set, stdout
+    // otherwise.
+    enum ConnectMode {
+        WaitForConnection,
+        ConnectInBackground
+    };
+    std::shared_ptr<Connection> connect(ConnectMode mode = WaitForConnection, String *error = 0);
 
     Flags<QueryMessage::Flag> mQueryFlags;
     int mMax, mTimeout, mMinOffset, mMaxOffset, mConnectTimeout, mBuildIndex;
@@ -210,6 +228,8 @@ private:
     Set<QueryMessage::PathFilter> mPathFilters;
     QueryMessage::KindFilters mKindFilters;
     UnsavedFiles mUnsavedFiles;
+    Hash<Path, uint64_t> mUnsavedFileVersions;
+    QueryMessage::UnsavedFileEdits mUnsavedFileEdits;
     List<std::shared_ptr<RCCommand> > mCommands;
     List<String> mRdmArgs;
     Path mSocketFile;
@@ -227,7 +247,13 @@ private:
     mutable List<String> mEnvironment;
 
     String mCommandLine;
+    // --unsaved-file and friends read from mInput, responses go to mOutput
+    // if set. Requests in --stdio-server mode have their own.
+    FILE *mInput;
+    String *mOutput;
+    bool mStdioServer, mStdioRequest;
     friend class CompileCommand;
+    friend class ::StdioServer;
 };
 
 #endif
@@ -29,6 +29,7 @@
 #include "IndexDataMessage.h"
 #include "LogOutputMessage.h"
 #include "QueryMessage.h"
+#include "Token.h"
 #include "rct/Rct.h"
 #include "rct/Connection.h"
 #include "rct/StopWatch.h"
@@ -586,6 +587,27 @@ bool TranslationUnit::reparse(CXUnsavedFile *unsaved, int unsavedCount)
     return true;
 }
 
+void tokenize(CXTranslationUnit unit, CXFile file, size_t size, List<std::pair<uint32_t, uint32_t> > &out)
+{
+    const CXSourceLocation startLoc = clang_getLocationForOffset(unit, file, 0);
+    const CXSourceLocation endLoc = clang_getLocationForOffset(unit, file, size);
+
+    CXSourceRange range = clang_getRange(startLoc, endLoc);
+    CXToken *tokens = 0;
+    unsigned numTokens = 0;
+    clang_tokenize(unit, range, &tokens, &numTokens);
+    out.reserve(out.size() + numTokens);
+    for (unsigned i=0; i<numTokens; ++i) {
+        range = clang_getTokenExtent(unit, tokens[i]);
+        unsigned offset, endOffset;
+        clang_getSpellingLocation(clang_getRangeStart(range), 0, 0, 0, &offset);
+        clang_getSpellingLocation(clang_getRangeEnd(range), 0, 0, 0, &endOffset);
+        out.append(std::make_pair(offset, Token::encode(clang_getTokenKind(tokens[i]), endOffset - offset)));
+    }
+
+    clang_disposeTokens(unit, tokens, numTokens);
+}
+
 #if 1
 struct No
 {
@@ -867,6 +889,18 @@ void DiagnosticsProvider::diagnose()
 #endif
 }
 
+uint32_t DiagnosticsProvider::resolveFile(CXFile file)
+{
+    CXString fileName = clang_getFileName(file);
+    const char *fn = clang_getCString(fileName);
+    if (!fn || !*fn || !strcmp("<built-in>", fn) || !strcmp("<command line>", fn)) {
+        clang_disposeString(fileName);
+        return 0;
+    }
+    const Path path = RTags::eatString(fileName);
+    return createLocation(path, 1, 1).fileId();
+}
+
 Location DiagnosticsProvider::createLocation(const CXCursor &cursor, CXCursorKind kind, bool *blocked, unsigned *offset)
 {
     if (kind == CXCursor_FirstInvalid)
@@ -119,7 +119,9 @@ enum ExitCode {
     ProtocolFailure = 37,
     ArgumentParseError = 38,
     UnexpectedMessageError = 39,
-    UnknownMessageError = 40
+    UnknownMessageError = 40,
+    UnsavedFileMismatch = 41,
+    Cancelled = 42
 };
 enum UnitType {
     CompileC,
@@ -188,6 +190,9 @@ struct TranslationUnit {
     String clangLine;
 };
 
+// Appends (offset, Token::encode(kind, length)) for every token in file
+void tokenize(CXTranslationUnit unit, CXFile file, size_t size, List<std::pair<uint32_t, uint32_t> > &tokens);
+
 struct CreateLocation
 {
     virtual ~CreateLocation() {}
@@ -246,6 +251,11 @@ struct CreateLocation
 
 struct DiagnosticsProvider
 {
+    DiagnosticsProvider()
+        : mFileCacheHits(0), mFileCacheMisses(0)
+    {
+        clearFileCache();
+    }
     virtual ~DiagnosticsProvider() {}
 
     inline CXFile getFile(size_t idx, const Path &path) const
@@ -260,47 +270,47 @@ struct DiagnosticsProvider
 
     inline Location createLocation(const CXSourceLocation &location, bool *blocked = 0, unsigned *offset = 0)
     {
-        CXString fileName;
         unsigned int line, col;
         CXFile file;
         clang_getSpellingLocation(location, &file, &line, &col, offset);
-        if (file) {
-            fileName = clang_getFileName(file);
-        } else {
-            if (blocked)
-                *blocked = false;
-            return Location();
-        }
-        const char *fn = clang_getCString(fileName);
-        assert(fn);
-        if (!*fn || !strcmp("<built-in>", fn) || !strcmp("<command line>", fn)) {
-            if (blocked)
-                *blocked = false;
-            clang_disposeString(fileName);
-            return Location();
-        }
-        const Path path = RTags::eatString(fileName);
-        const Location ret = createLocation(path, line, col, blocked);
-        return ret;
+        return createLocation(file, line, col, blocked);
     }
     inline Location createLocation(CXFile file, unsigned int line, unsigned int col, bool *blocked = 0)
     {
-        if (blocked)
-            *blocked = false;
-        if (!file)
+        if (!file) {
+            if (blocked)
+                *blocked = false;
             return Location();
+        }
 
-        CXString fn = clang_getFileName(file);
-        const char *cstr = clang_getCString(fn);
-        if (!cstr) {
-            clang_disposeString(fn);
-            return Location();
+        // Every CXFile is resolved to a fileId once per translation unit,
+        // after that it's just a pointer compare.
+        FileCacheEntry &entry = mFileCache[(reinterpret_cast<uintptr_t>(file) >> 4) & (FileCacheSize - 1)];
+        if (entry.file == file) {
+            ++mFileCacheHits;
+        } else {
+            ++mFileCacheMisses;
+            entry.file = file;
+            entry.fileId = resolveFile(file);
+            entry.blockedKnown = false;
+            entry.blocked = false;
         }
-        const Path p = Path::resolved(cstr);
-        clang_disposeString(fn);
-        return createLocation(p, line, col, blocked);
+        if (blocked) {
+            // Asking whether a file is blocked adds it to the files of the
+            // IndexDataMessage so only do that for callers that ask
+            if (!entry.blockedKnown && entry.fileId) {
+                createLocation(Location::path(entry.fileId), line, col, &entry.blocked);
+                entry.blockedKnown = true;
+            }
+            *blocked = entry.blocked;
+        }
+        return entry.fileId ? Location(entry.fileId, line, col) : Location();
     }
     Location createLocation(const CXCursor &cursor, CXCursorKind kind = CXCursor_FirstInvalid, bool *blocked = 0, unsigned *offset = 0);
+    // CXFiles are only unique while their translation unit is alive
+    void clearFileCache() { memset(mFileCache, 0, sizeof(mFileCache)); }
+    size_t fileCacheHits() const { return mFileCacheHits; }
+    size_t fileCacheMisses() const { return mFileCacheMisses; }
     virtual size_t unitCount() const = 0;
     virtual size_t diagnosticCount(size_t unit) const = 0;
     virtual CXDiagnostic diagnostic(size_t unit, size_t idx) const = 0;
@@ -310,6 +320,17 @@ struct DiagnosticsProvider
     virtual CXTranslationUnit unit(size_t unit) const = 0;
 
     void diagnose();
+private:
+    uint32_t resolveFile(CXFile file);
+
+    enum { FileCacheSize = 256 };
+    struct FileCacheEntry {
+        CXFile file;
+        uint32_t fileId;
+        bool blockedKnown, blocked;
+    };
+    FileCacheEntry mFileCache[FileCacheSize];
+    size_t mFileCacheHits, mFileCacheMisses;
 };
 
 struct Auto {
@@ -394,6 +415,17 @@ inline const char *tokenKindSpelling(CXTokenKind kind)
     return 0;
 }
 
+// 64-bit FNV-1a, pass the previous hash as seed to continue it
+inline uint64_t fnv1a(const char *data, size_t size, uint64_t seed = 14695981039346656037ull)
+{
+    uint64_t hash = seed;
+    for (size_t i=0; i<size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
 template <typename T>
 inline bool startsWith(const List<T> &list, const T &str)
 {
@@ -0,0 +1,380 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "SegmentedDatabase.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rct/EventLoop.h"
+#include "rct/Log.h"
+#include "rct/Rct.h"
+#include "rct/SignalSlot.h"
+#include "rct/Thread.h"
+
+enum {
+    Magic = 0x52544753, // RTGS
+    MinCompactBytes = 64 * 1024 * 1024
+};
+
+static bool lockFile(int fd, short type)
+{
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+    fl.l_pid = getpid();
+    int ret;
+    eintrwrap(ret, fcntl(fd, F_SETLKW, &fl));
+    return ret != -1;
+}
+
+static bool writeAll(int fd, const char *data, size_t size)
+{
+    while (size) {
+        ssize_t w;
+        eintrwrap(w, ::write(fd, data, size));
+        if (w <= 0)
+            return false;
+        data += w;
+        size -= w;
+    }
+    return true;
+}
+
+// Opens the segment and takes the write lock. Compaction replaces the segment
+// with rename(2) so after we get the lock we have to make sure we're still
+// looking at the file that lives at path.
+static int lockSegment(const Path &path, struct stat *st, String *error)
+{
+    for (int i=0; i<10; ++i) {
+        int fd;
+        eintrwrap(fd, open(path.constData(), O_RDWR|O_CREAT, 0644));
+        if (fd == -1) {
+            Path::mkdir(path.parentDir(), Path::Recursive);
+            eintrwrap(fd, open(path.constData(), O_RDWR|O_CREAT, 0644));
+            if (fd == -1)
+                break;
+        }
+        if (!lockFile(fd, F_WRLCK)) {
+            ::close(fd);
+            break;
+        }
+        struct stat current;
+        if (!fstat(fd, st) && !stat(path.constData(), &current) && current.st_ino == st->st_ino)
+            return fd;
+        lockFile(fd, F_UNLCK);
+        ::close(fd);
+    }
+    if (error)
+        *error = "Failed to lock " + path + ": " + Rct::strerror();
+    return -1;
+}
+
+size_t SegmentedDatabase::append(const Path &path, const List<Record> &records, uint64_t generation, String *error)
+{
+    struct stat st;
+    const int fd = lockSegment(path, &st, error);
+    if (fd == -1)
+        return 0;
+
+    const off_t start = st.st_size;
+    bool ok = lseek(fd, start, SEEK_SET) == start;
+    size_t written = 0;
+    for (size_t i=0; ok && i<records.size(); ++i) {
+        const Record &record = records.at(i);
+        const Header header = {
+            Magic, record.fileId, static_cast<uint32_t>(record.type),
+            static_cast<uint32_t>(record.data.size()), generation
+        };
+        ok = (writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header))
+              && writeAll(fd, record.data.constData(), record.data.size()));
+        written += sizeof(header) + record.data.size();
+    }
+    if (!ok) {
+        if (error)
+            *error = "Failed to write to " + path + ": " + Rct::strerror();
+        // roll back so rdm never sees a partial job
+        if (::ftruncate(fd, start) == -1)
+            ::error() << "Failed to roll back" << path << Rct::strerror();
+        written = 0;
+    }
+    lockFile(fd, F_UNLCK);
+    ::close(fd);
+    return written;
+}
+
+class CompactionThread : public Thread
+{
+public:
+    CompactionThread(const Path &path)
+        : mPath(path)
+    {}
+
+    virtual void run() override
+    {
+        mFinished(compact());
+    }
+
+    Signal<std::function<void(bool)> > &finished() { return mFinished; }
+private:
+    bool compact()
+    {
+        String err;
+        struct stat st;
+        const int fd = lockSegment(mPath, &st, &err);
+        if (fd == -1) {
+            error() << "Compaction failed" << err;
+            return false;
+        }
+        bool ok = false;
+        const Path tmp = mPath + ".compact";
+        const char *data = 0;
+        if (st.st_size)
+            data = static_cast<const char*>(mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if (data && data != MAP_FAILED) {
+            // newest record wins, scan everything first
+            Hash<uint64_t, uint64_t> live;
+            uint64_t offset = 0;
+            Header header;
+            while (offset + sizeof(Header) <= static_cast<uint64_t>(st.st_size)) {
+                memcpy(&header, data + offset, sizeof(Header));
+                if (header.magic != Magic || offset + sizeof(Header) + header.size > static_cast<uint64_t>(st.st_size))
+                    break;
+                if (header.type == Type_Removed) {
+                    for (uint32_t type=Type_Symbols; type<Type_Removed; ++type)
+                        live.remove((static_cast<uint64_t>(header.fileId) << 32) | type);
+                } else {
+                    live[(static_cast<uint64_t>(header.fileId) << 32) | header.type] = offset;
+                }
+                offset += sizeof(Header) + header.size;
+            }
+
+            List<uint64_t> offsets;
+            offsets.reserve(live.size());
+            for (const auto &it : live)
+                offsets.append(it.second);
+            offsets.sort();
+
+            int out;
+            eintrwrap(out, open(tmp.constData(), O_RDWR|O_CREAT|O_TRUNC, 0644));
+            if (out != -1) {
+                ok = true;
+                for (size_t i=0; ok && i<offsets.size(); ++i) {
+                    memcpy(&header, data + offsets.at(i), sizeof(Header));
+                    ok = writeAll(out, data + offsets.at(i), sizeof(Header) + header.size);
+                }
+                ok = ok && !fdatasync(out);
+                ::close(out);
+                if (ok)
+                    ok = !rename(tmp.constData(), mPath.constData());
+                if (!ok)
+                    unlink(tmp.constData());
+            }
+            munmap(const_cast<char*>(data), st.st_size);
+        }
+        if (!ok)
+            error() << "Compaction of" << mPath << "failed" << Rct::strerror();
+        lockFile(fd, F_UNLCK);
+        ::close(fd);
+        return ok;
+    }
+
+    const Path mPath;
+    Signal<std::function<void(bool)> > mFinished;
+};
+
+SegmentedDatabase::Mapping::~Mapping()
+{
+    if (data)
+        munmap(const_cast<char*>(data), size);
+}
+
+SegmentedDatabase::SegmentedDatabase(const Path &path)
+    : mPath(path), mScanned(0), mInode(0), mDevice(0), mLiveBytes(0), mDeadBytes(0),
+      mCompacting(false), mAlive(std::make_shared<bool>(true))
+{
+}
+
+SegmentedDatabase::~SegmentedDatabase()
+{
+}
+
+bool SegmentedDatabase::refresh(String *error)
+{
+    int fd;
+    eintrwrap(fd, open(mPath.constData(), O_RDONLY));
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            // nothing indexed yet
+            mDirectory.clear();
+            mMapping.reset();
+            mScanned = mLiveBytes = mDeadBytes = 0;
+            mInode = 0;
+            mDevice = 0;
+            return true;
+        }
+        if (error)
+            *error = "Failed to open " + mPath + ": " + Rct::strerror();
+        return false;
+    }
+    if (!lockFile(fd, F_RDLCK)) {
+        if (error)
+            *error = "Failed to lock " + mPath + ": " + Rct::strerror();
+        ::close(fd);
+        return false;
+    }
+
+    bool ok = true;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        ok = false;
+    } else {
+        // compacted (or cleared) since last time, start over. A new file
+        // can have the old one's size so it has to be mapped again too.
+        const bool replaced = (st.st_ino != mInode || st.st_dev != mDevice
+                               || static_cast<uint64_t>(st.st_size) < mScanned);
+        if (replaced) {
+            mDirectory.clear();
+            mScanned = mLiveBytes = mDeadBytes = 0;
+            mInode = st.st_ino;
+            mDevice = st.st_dev;
+        }
+        if (replaced || !mMapping || mMapping->size != static_cast<size_t>(st.st_size)) {
+            auto mapping = std::make_shared<Mapping>();
+            if (st.st_size) {
+                const char *data = static_cast<const char*>(mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+                if (data == MAP_FAILED) {
+                    ok = false;
+                } else {
+                    mapping->data = data;
+                    mapping->size = st.st_size;
+                }
+            }
+            // FileMaps handed out earlier keep the old mapping alive
+            if (ok)
+                mMapping = mapping;
+        }
+    }
+
+    if (ok && mMapping) {
+        Header header;
+        while (mScanned + sizeof(Header) <= mMapping->size) {
+            memcpy(&header, mMapping->data + mScanned, sizeof(Header));
+            if (header.magic != Magic || mScanned + sizeof(Header) + header.size > mMapping->size) {
+                ::error() << "Corrupted segment" << mPath << "at" << mScanned;
+                break;
+            }
+            const uint64_t offset = mScanned + sizeof(Header);
+            const size_t recordSize = sizeof(Header) + header.size;
+            mScanned += recordSize;
+            if (header.type == Type_Removed) {
+                for (uint32_t type=Type_Symbols; type<Type_Removed; ++type) {
+                    const auto it = mDirectory.find(key(header.fileId, type));
+                    if (it != mDirectory.end()) {
+                        mLiveBytes -= sizeof(Header) + it->second.size;
+                        mDeadBytes += sizeof(Header) + it->second.size;
+                        mDirectory.erase(it);
+                    }
+                }
+                mDeadBytes += recordSize;
+                continue;
+            }
+            Entry &entry = mDirectory[key(header.fileId, header.type)];
+            if (entry.offset) {
+                mLiveBytes -= sizeof(Header) + entry.size;
+                mDeadBytes += sizeof(Header) + entry.size;
+            }
+            entry.offset = offset;
+            entry.size = header.size;
+            entry.generation = header.generation;
+            mLiveBytes += recordSize;
+        }
+    }
+
+    if (!ok && error)
+        *error = "Failed to map " + mPath + ": " + Rct::strerror();
+    lockFile(fd, F_UNLCK);
+    ::close(fd);
+    return ok;
+}
+
+void SegmentedDatabase::clear()
+{
+    mDirectory.clear();
+    mMapping.reset();
+    mScanned = mLiveBytes = mDeadBytes = 0;
+    mInode = 0;
+    mDevice = 0;
+    Path::rm(mPath);
+}
+
+bool SegmentedDatabase::remove(uint32_t fileId)
+{
+    List<Record> records;
+    records.append({ fileId, Type_Removed, String() });
+    String err;
+    if (!append(mPath, records, 0, &err)) {
+        error() << "Failed to remove" << fileId << "from" << mPath << err;
+        return false;
+    }
+    return refresh();
+}
+
+void SegmentedDatabase::compact()
+{
+    if (mCompacting || mDeadBytes < MinCompactBytes || mDeadBytes < mLiveBytes)
+        return;
+
+    warning() << "Compacting" << mPath << mLiveBytes << "live bytes" << mDeadBytes << "dead bytes";
+    mCompacting = true;
+    CompactionThread *thread = new CompactionThread(mPath);
+    thread->setAutoDelete(true);
+    std::weak_ptr<bool> alive = mAlive;
+    thread->finished().connect<EventLoop::Move>([this, alive](bool ok) {
+            if (alive.lock())
+                onCompactionFinished(ok);
+        });
+    thread->start();
+}
+
+void SegmentedDatabase::onCompactionFinished(bool ok)
+{
+    mCompacting = false;
+    if (ok)
+        refresh();
+}
+
+bool SegmentedDatabase::contains(uint32_t fileId, RecordType type) const
+{
+    return mDirectory.contains(key(fileId, type));
+}
+
+uint32_t SegmentedDatabase::recordSize(uint32_t fileId, RecordType type) const
+{
+    return mDirectory.value(key(fileId, type)).size;
+}
+
+String SegmentedDatabase::record(uint32_t fileId, RecordType type) const
+{
+    const auto it = mDirectory.find(key(fileId, type));
+    if (it == mDirectory.end() || !mMapping || it->second.offset + it->second.size > mMapping->size)
+        return String();
+    return String(mMapping->data + it->second.offset, it->second.size);
+}
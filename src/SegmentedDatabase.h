@@ -0,0 +1,138 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SegmentedDatabase_h
+#define SegmentedDatabase_h
+
+#include <sys/types.h>
+#include <memory>
+
+#include "FileMap.h"
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Path.h"
+#include "rct/String.h"
+
+// Optional storage engine (rdm --segmented-storage). Instead of one
+// directory with five or six files per fileId every rp appends the encoded
+// maps of all the units it visited as records to one shared, append-only
+// segment file. rdm keeps an in-memory directory of the newest record for
+// each (fileId, type) and hands out FileMaps pointing straight into one
+// shared mmap of the segment. Superseded records are dropped by a background
+// compaction that rewrites the segment.
+class SegmentedDatabase
+{
+public:
+    enum RecordType {
+        Type_Symbols,
+        Type_SymbolNames,
+        Type_Targets,
+        Type_Usrs,
+        Type_Tokens,
+        Type_SymbolNameSuffixes,
+        Type_Info,
+        Type_Unsaved,
+        Type_Removed // tombstone, drops every record for the fileId
+    };
+
+    struct Record {
+        uint32_t fileId;
+        RecordType type;
+        String data;
+    };
+
+    struct Header {
+        uint32_t magic;
+        uint32_t fileId;
+        uint32_t type;
+        uint32_t size;
+        uint64_t generation;
+    };
+
+    static Path segmentPath(const Path &projectDataDir) { return projectDataDir + "database"; }
+
+    // Called from rp. All records are appended under one write lock so rdm
+    // sees either all or none of them. Returns the number of bytes written.
+    static size_t append(const Path &path, const List<Record> &records, uint64_t generation, String *error = 0);
+
+    SegmentedDatabase(const Path &path);
+    ~SegmentedDatabase();
+
+    Path path() const { return mPath; }
+    bool refresh(String *error = 0);
+    void clear();
+    bool remove(uint32_t fileId);
+    void compact();
+
+    bool contains(uint32_t fileId, RecordType type) const;
+    // 0 if there's no such record
+    uint32_t recordSize(uint32_t fileId, RecordType type) const;
+    String record(uint32_t fileId, RecordType type) const;
+    template <typename Key, typename Value>
+    std::shared_ptr<FileMap<Key, Value> > fileMap(uint32_t fileId, RecordType type, String *error = 0) const;
+
+    size_t liveBytes() const { return mLiveBytes; }
+    size_t deadBytes() const { return mDeadBytes; }
+    size_t recordCount() const { return mDirectory.size(); }
+private:
+    struct Mapping {
+        Mapping()
+            : data(0), size(0)
+        {}
+        ~Mapping();
+
+        const char *data;
+        size_t size;
+    };
+    struct Entry {
+        uint64_t offset;
+        uint32_t size;
+        uint64_t generation;
+    };
+    static inline uint64_t key(uint32_t fileId, uint32_t type) { return (static_cast<uint64_t>(fileId) << 32) | type; }
+    void onCompactionFinished(bool ok);
+
+    const Path mPath;
+    Hash<uint64_t, Entry> mDirectory;
+    std::shared_ptr<Mapping> mMapping;
+    uint64_t mScanned;
+    ino_t mInode;
+    dev_t mDevice;
+    size_t mLiveBytes, mDeadBytes;
+    bool mCompacting;
+    std::shared_ptr<bool> mAlive;
+};
+
+template <typename Key, typename Value>
+inline std::shared_ptr<FileMap<Key, Value> > SegmentedDatabase::fileMap(uint32_t fileId, RecordType type, String *error) const
+{
+    const auto it = mDirectory.find(key(fileId, type));
+    if (it == mDirectory.end()) {
+        if (error)
+            *error = String::format<128>("No record of type %d for %u in %s", type, fileId, mPath.constData());
+        return std::shared_ptr<FileMap<Key, Value> >();
+    }
+    assert(mMapping);
+    if (it->second.size < sizeof(uint32_t) * 2 || it->second.offset + it->second.size > mMapping->size) {
+        if (error)
+            *error = String::format<128>("Corrupted record of type %d for %u in %s", type, fileId, mPath.constData());
+        return std::shared_ptr<FileMap<Key, Value> >();
+    }
+    auto ret = std::make_shared<FileMap<Key, Value> >();
+    ret->init(mMapping->data + it->second.offset, it->second.size, mMapping);
+    return ret;
+}
+
+#endif
@@ -17,6 +17,7 @@
 #include <rct/ThreadPool.h>
 #include "TokensJob.h"
 
+#include <algorithm>
 #include <arpa/inet.h>
 #include <clang-c/Index.h>
 #include <clang-c/CXCompilationDatabase.h>
@@ -45,6 +46,7 @@
 #include "Project.h"
 #include "QueryMessage.h"
 #include "RClient.h"
+#include "SharedMemory.h"
 #include "IndexParseData.h"
 #include "rct/Connection.h"
 #include "rct/DataFile.h"
@@ -123,6 +125,8 @@ bool Server::init(const Options &options)
 
     mOptions = options;
     mSuspended = (options.options & StartSuspended);
+    // unsaved buffers and index data a dead rdm or rp didn't get to unlink
+    SharedMemory::sweep();
     mOptions.defaultArguments << String::format<32>("-ferror-limit=%d", mOptions.errorLimit);
     if (options.options & Wall)
         mOptions.defaultArguments << "-Wall";
@@ -670,6 +674,15 @@ void Server::handleQueryMessage(const std::shared_ptr<QueryMessage> &message, co
         LogOutput::StdOut|LogOutput::TrailingNewLine) << message->commandLine();
     conn->setSilent(message->flags() & QueryMessage::Silent);
 
+    if (!message->unsavedFileVersions().isEmpty() || !message->unsavedFileEdits().isEmpty()) {
+        String err;
+        if (!mBufferStore.resolve(message, &err)) {
+            conn->write(err);
+            conn->finish(RTags::UnsavedFileMismatch);
+            return;
+        }
+    }
+
     switch (message->type()) {
     case QueryMessage::Invalid:
         assert(0);
@@ -1895,6 +1908,8 @@ void Server::setBuffers(const std::shared_ptr<QueryMessage> &query, const std::s
                     return Path::Continue;
                 });
         }
+        mJobScheduler->setActiveBuffers(mActiveBuffers);
+        mBufferStore.retain(mActiveBuffers);
     }
     mJobScheduler->sort();
     conn->finish();
@@ -1977,6 +1992,23 @@ void Server::tokens(const std::shared_ptr<QueryMessage> &query, const std::share
         return;
     }
 
+    if (mOptions.options & LazyTokens && !project->hasTokens(fileId)) {
+        std::weak_ptr<Connection> weak = conn;
+        project->createTokens(fileId, [query, fileId, from, to, project, weak](const String &err) {
+                std::shared_ptr<Connection> c = weak.lock();
+                if (!c)
+                    return;
+                if (!err.isEmpty()) {
+                    c->write(err);
+                    c->finish(RTags::GeneralFailure);
+                    return;
+                }
+                TokensJob job(query, fileId, from, to, project);
+                c->finish(job.run(c));
+            });
+        return;
+    }
+
     TokensJob job(query, fileId, from, to, project);
     conn->finish(job.run(conn));
 }
@@ -2204,7 +2236,8 @@ void Server::codeCompleteAt(const std::shared_ptr<QueryMessage> &query, const st
     }
 
     if (!mCompletionThread) {
-        mCompletionThread = new CompletionThread(mOptions.completionCacheSize);
+        mCompletionThread = new CompletionThread(mOptions.completionCacheSize, mOptions.completionThreads,
+                                                 static_cast<size_t>(mOptions.completionCacheMemory) * 1024 * 1024);
         mCompletionThread->start();
     }
 
@@ -2440,26 +2473,85 @@ bool Server::runTests()
     return ret;
 }
 
+// Headers are completed in the unit of a source that includes them
+static Source completionSource(const std::shared_ptr<Project> &project, uint32_t fileId, int buildIndex)
+{
+    Source source = project->source(fileId, buildIndex);
+    if (source.isNull()) {
+        for (const uint32_t dep : project->dependencies(fileId, Project::DependsOnArg)) {
+            source = project->source(dep, buildIndex);
+            if (!source.isNull())
+                break;
+        }
+    }
+    return source;
+}
+
 void Server::prepareCompletion(const std::shared_ptr<QueryMessage> &query, uint32_t fileId, const std::shared_ptr<Project> &project)
 {
     if (query->flags() & QueryMessage::CodeCompletionEnabled && !mCompletionThread) {
-        mCompletionThread = new CompletionThread(mOptions.completionCacheSize);
+        mCompletionThread = new CompletionThread(mOptions.completionCacheSize, mOptions.completionThreads,
+                                                 static_cast<size_t>(mOptions.completionCacheMemory) * 1024 * 1024);
         mCompletionThread->start();
     }
 
     if (mCompletionThread && fileId) {
         if (!mCompletionThread->isCached(fileId, project)) {
-            Source source = project->source(fileId, query->buildIndex());
-            if (source.isNull()) {
-                for (const uint32_t dep : project->dependencies(fileId, Project::DependsOnArg)) {
-                    source = project->source(dep, query->buildIndex());
-                    if (!source.isNull())
-                        break;
-                }
-            }
-
+            Source source = completionSource(project, fileId, query->buildIndex());
             if (!source.isNull())
                 mCompletionThread->prepare(std::move(source), query->unsavedFiles().value(Location::path(fileId)));
         }
+        if (mOptions.options & SpeculativeCompletions)
+            predictCompletions(query, fileId, project);
+    }
+}
+
+void Server::predictCompletions(const std::shared_ptr<QueryMessage> &query, uint32_t fileId, const std::shared_ptr<Project> &project)
+{
+    // Only worth doing when the user moves to another file
+    if (!mRecentFiles.isEmpty() && mRecentFiles.front() == fileId)
+        return;
+    auto it = std::find(mRecentFiles.begin(), mRecentFiles.end(), fileId);
+    if (it != mRecentFiles.end())
+        mRecentFiles.erase(it);
+    mRecentFiles.insert(mRecentFiles.begin(), fileId);
+    const size_t max = std::max(mOptions.completionCacheSize, 1);
+    if (mRecentFiles.size() > max)
+        mRecentFiles.resize(max);
+
+    // The buffers the user was in recently and is likely to go back to...
+    List<uint32_t> targets;
+    for (size_t i=1; i<mRecentFiles.size(); ++i) {
+        if (mActiveBuffers.isEmpty() || mActiveBuffers.contains(mRecentFiles.at(i)))
+            targets.append(mRecentFiles.at(i));
+    }
+
+    // ...and the files implementing the project headers this one includes
+    if (const DependencyNode *node = project->dependencyNode(fileId)) {
+        const Path projectPath = project->path();
+        for (const auto &include : node->includes) {
+            const Path header = Location::path(include.first);
+            if (!header.startsWith(projectPath) || !header.isHeader())
+                continue;
+            const String base = header.left(header.lastIndexOf('.') + 1);
+            for (const char *suffix : { "cpp", "cc", "cxx", "c", "mm", "m" }) {
+                const uint32_t id = Location::fileId(base + suffix);
+                if (id && id != fileId && project->hasSource(id)) {
+                    if (!targets.contains(id))
+                        targets.append(id);
+                    break;
+                }
+            }
+        }
+    }
+
+    // the completion thread drops these once its cache is full
+    for (size_t i=0; i<targets.size() && i<max; ++i) {
+        const uint32_t target = targets.at(i);
+        if (mCompletionThread->isCached(target, project))
+            continue;
+        Source source = completionSource(project, target, query->buildIndex());
+        if (!source.isNull())
+            mCompletionThread->prepareSpeculatively(std::move(source), query->unsavedFiles().value(Location::path(target)));
     }
 }
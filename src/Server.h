@@ -16,7 +16,9 @@
 #ifndef Server_h
 #define Server_h
 
+#include "BufferStore.h"
 #include "IndexMessage.h"
+#include "LineCache.h"
 #include "rct/Flags.h"
 #include "rct/Hash.h"
 #include "rct/List.h"
@@ -88,14 +90,20 @@ public:
         Separate32BitAnd64Bit = (1ull << 31),
         SourceIgnoreIncludePathDifferencesInUsr = (1ull << 32),
         NoLibClangIncludePath = (1ull << 33),
-        TranslationUnitCache = (1ull << 34)
+        TranslationUnitCache = (1ull << 34),
+        SegmentedStorage = (1ull << 35),
+        HeaderCoverageScheduling = (1ull << 36),
+        AdaptiveJobCount = (1ull << 37),
+        LazyTokens = (1ull << 38),
+        ResidentTranslationUnits = (1ull << 39),
+        SpeculativeCompletions = (1ull << 40)
     };
     struct Options {
         Options()
             : jobCount(0), headerErrorJobCount(0), maxIncludeCompletionDepth(0),
               rpVisitFileTimeout(0), rpIndexDataMessageTimeout(0), rpConnectTimeout(0),
               rpConnectAttempts(0), rpNiceValue(0), maxCrashCount(0),
-              completionCacheSize(0), testTimeout(60 * 1000 * 5),
+              completionCacheSize(0), completionThreads(1), completionCacheMemory(0), maxCompletions(0), testTimeout(60 * 1000 * 5),
               maxFileMapScopeCacheSize(512), pollTimer(0), tcpPort(0)
         {
         }
@@ -105,7 +113,7 @@ public:
         size_t jobCount, headerErrorJobCount, maxIncludeCompletionDepth;
         int rpVisitFileTimeout, rpIndexDataMessageTimeout,
             rpConnectTimeout, rpConnectAttempts, rpNiceValue, maxCrashCount,
-            completionCacheSize, testTimeout, maxFileMapScopeCacheSize, errorLimit,
+            completionCacheSize, completionThreads, completionCacheMemory, maxCompletions, testTimeout, maxFileMapScopeCacheSize, errorLimit,
             pollTimer;
         uint16_t tcpPort;
         List<String> defaultArguments, excludeFilters;
@@ -127,6 +135,7 @@ public:
     void dumpJobs(const std::shared_ptr<Connection> &conn);
     std::shared_ptr<JobScheduler> jobScheduler() const { return mJobScheduler; }
     const Set<uint32_t> &activeBuffers() const { return mActiveBuffers; }
+    LineCache &lineCache() { return mLineCache; }
     bool isActiveBuffer(uint32_t fileId) const { return mActiveBuffers.contains(fileId); }
     int exitCode() const { return mExitCode; }
     std::shared_ptr<Project> currentProject() const { return mCurrentProject.lock(); }
@@ -205,6 +214,7 @@ private:
     bool initServers();
     void removeSocketFile();
     void prepareCompletion(const std::shared_ptr<QueryMessage> &query, uint32_t fileId, const std::shared_ptr<Project> &project);
+    void predictCompletions(const std::shared_ptr<QueryMessage> &query, uint32_t fileId, const std::shared_ptr<Project> &project);
 
     typedef Hash<Path, std::shared_ptr<Project> > ProjectsMap;
     ProjectsMap mProjects;
@@ -221,6 +231,9 @@ private:
     std::shared_ptr<JobScheduler> mJobScheduler;
     CompletionThread *mCompletionThread;
     Set<uint32_t> mActiveBuffers;
+    BufferStore mBufferStore;
+    LineCache mLineCache;
+    List<uint32_t> mRecentFiles; // most recent first
     Set<std::shared_ptr<Connection> > mConnections;
 
     Signal<std::function<void()> > mIndexDataMessageReceived;
@@ -0,0 +1,224 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "SharedMemory.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mutex>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "rct/Log.h"
+#include "rct/Path.h"
+#include "rct/Rct.h"
+#include "RTags.h"
+
+namespace SharedMemory {
+static std::mutex sMutex;
+static Hash<uint64_t, std::weak_ptr<Segment> > sPublished;
+
+static uint64_t contentHash(const String &contents)
+{
+    // the size is checked on the other end as well
+    return RTags::fnv1a(contents.constData(), contents.size()) ^ contents.size();
+}
+
+Segment::~Segment()
+{
+    unlink(mName);
+}
+
+Mapping::~Mapping()
+{
+    if (mData)
+        munmap(const_cast<char*>(mData), mSize);
+}
+
+bool Mapping::map(const String &name, size_t size, String *error)
+{
+    assert(!mData);
+    if (!size)
+        return true;
+    int fd;
+    eintrwrap(fd, shm_open(name.constData(), O_RDONLY, 0));
+    if (fd == -1) {
+        if (error)
+            *error = "Failed to open " + name + ": " + Rct::strerror();
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || static_cast<size_t>(st.st_size) != size) {
+        if (error)
+            *error = String::format<128>("Wrong size for %s, expected %zu", name.constData(), size);
+        ::close(fd);
+        return false;
+    }
+    void *data = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        if (error)
+            *error = "Failed to map " + name + ": " + Rct::strerror();
+        return false;
+    }
+    mData = static_cast<const char*>(data);
+    mSize = size;
+    return true;
+}
+
+bool write(const String &name, const char *data, size_t size, String *error)
+{
+    int fd = -1;
+    for (int i=0; i<2 && fd == -1; ++i) {
+        eintrwrap(fd, shm_open(name.constData(), O_RDWR|O_CREAT|O_EXCL, 0600));
+        if (fd == -1 && errno == EEXIST) {
+            // left over from a process that didn't clean up
+            unlink(name);
+        }
+    }
+    if (fd == -1) {
+        if (error)
+            *error = "Failed to create " + name + ": " + Rct::strerror();
+        return false;
+    }
+    bool ok = !ftruncate(fd, size);
+    if (ok && size) {
+        void *mapped = mmap(0, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ok = false;
+        } else {
+            memcpy(mapped, data, size);
+            munmap(mapped, size);
+        }
+    }
+    ::close(fd);
+    if (!ok) {
+        if (error)
+            *error = "Failed to write " + name + ": " + Rct::strerror();
+        unlink(name);
+    }
+    return ok;
+}
+
+std::shared_ptr<Segment> publish(const String &contents, String *error)
+{
+    const uint64_t hash = contentHash(contents);
+    std::lock_guard<std::mutex> lock(sMutex);
+    std::weak_ptr<Segment> &weak = sPublished[hash];
+    std::shared_ptr<Segment> ret = weak.lock();
+    if (ret) {
+        // The name only says the hash matches, make sure it's the same buffer
+        Mapping mapping;
+        if (!mapping.map(ret->name(), ret->size(), error)
+            || mapping.size() != contents.size()
+            || memcmp(mapping.data(), contents.constData(), contents.size())) {
+            if (error && error->isEmpty())
+                *error = "Hash collision for " + ret->name();
+            // the caller sends these contents inline
+            return std::shared_ptr<Segment>();
+        }
+    } else {
+        const String name = String::format<64>("/rt%x-%llx", static_cast<unsigned int>(getpid()), static_cast<unsigned long long>(hash));
+        if (write(name, contents.constData(), contents.size(), error)) {
+            ret.reset(new Segment(name, contents.size()));
+            weak = ret;
+        } else {
+            sPublished.remove(hash);
+        }
+    }
+    return ret;
+}
+
+bool unlink(const String &name)
+{
+    return !shm_unlink(name.constData());
+}
+
+void sweep()
+{
+    // Only Linux lets us list the objects, there they live in /dev/shm
+    Path dir("/dev/shm/");
+    if (!dir.isDir())
+        return;
+    dir.visit([](const Path &path) {
+            // "rt<pid>-<hash>" from rdm, "rtp<pid>-<id>" from rp, all hex
+            const char *name = path.fileName();
+            if (strncmp(name, "rt", 2))
+                return Path::Continue;
+            const char *pid = name + (name[2] == 'p' ? 3 : 2);
+            char *end;
+            const unsigned long owner = strtoul(pid, &end, 16);
+            if (end == pid || *end != '-' || !owner || !end[1] || strspn(end + 1, "0123456789abcdef") != strlen(end + 1))
+                return Path::Continue;
+            if (kill(owner, 0) == -1 && errno == ESRCH) {
+                warning() << "Removing shared memory left behind by" << owner << name;
+                unlink(String("/") + name);
+            }
+            return Path::Continue;
+        });
+}
+
+void encodeUnsavedFiles(Serializer &serializer, const UnsavedFiles &unsavedFiles,
+                        List<std::shared_ptr<Segment> > &segments)
+{
+    serializer << static_cast<uint32_t>(unsavedFiles.size());
+    for (const auto &it : unsavedFiles) {
+        std::shared_ptr<Segment> segment;
+        if (it.second.size() >= Threshold) {
+            String err;
+            segment = publish(it.second, &err);
+            if (!segment)
+                warning() << "Failed to share unsaved contents of" << it.first << err;
+        }
+        serializer << it.first;
+        if (segment) {
+            serializer << segment->name() << static_cast<uint64_t>(segment->size());
+            segments.append(segment);
+        } else {
+            serializer << String() << it.second;
+        }
+    }
+}
+
+bool decodeUnsavedFiles(Deserializer &deserializer, UnsavedFiles &unsavedFiles, String *error)
+{
+    uint32_t count;
+    deserializer >> count;
+    bool ok = true;
+    for (uint32_t i=0; i<count; ++i) {
+        Path path;
+        String name;
+        deserializer >> path >> name;
+        String &contents = unsavedFiles[path];
+        if (name.isEmpty()) {
+            deserializer >> contents;
+        } else {
+            uint64_t size;
+            deserializer >> size;
+            Mapping mapping;
+            if (mapping.map(name, size, error)) {
+                contents = String(mapping.data(), mapping.size());
+            } else {
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+}
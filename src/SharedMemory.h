@@ -0,0 +1,92 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SharedMemory_h
+#define SharedMemory_h
+
+#include <memory>
+
+#include "rct/Hash.h"
+#include "rct/List.h"
+#include "rct/Serializer.h"
+#include "rct/String.h"
+#include "RTags.h"
+
+// Named POSIX shared memory objects used to move large blobs between rdm and
+// rp without pushing them through rp's stdin or the rdm socket. Unsaved
+// buffers are published by rdm under a name derived from their contents so
+// every job that needs the same buffer shares one object, rp maps them
+// read-only. Large IndexDataMessages go the other way, rp writes the payload
+// to an object and only sends the name, rdm maps it, decodes and unlinks it.
+namespace SharedMemory {
+enum {
+    Threshold = 64 * 1024
+};
+
+class Segment
+{
+public:
+    ~Segment();
+    const String &name() const { return mName; }
+    size_t size() const { return mSize; }
+private:
+    Segment(const String &name, size_t size)
+        : mName(name), mSize(size)
+    {}
+    friend std::shared_ptr<Segment> publish(const String &contents, String *error);
+
+    const String mName;
+    const size_t mSize;
+};
+
+class Mapping
+{
+public:
+    Mapping()
+        : mData(0), mSize(0)
+    {}
+    ~Mapping();
+
+    bool map(const String &name, size_t size, String *error = 0);
+    const char *data() const { return mData; }
+    size_t size() const { return mSize; }
+private:
+    Mapping(const Mapping &) = delete;
+    Mapping &operator=(const Mapping &) = delete;
+
+    const char *mData;
+    size_t mSize;
+};
+
+// Creates the object, whoever maps it last is responsible for unlinking it.
+bool write(const String &name, const char *data, size_t size, String *error = 0);
+// Content addressed, publishing the same contents twice returns the same
+// Segment. The object is unlinked when the last reference goes away.
+// Returns null if different contents with the same hash are published.
+std::shared_ptr<Segment> publish(const String &contents, String *error = 0);
+bool unlink(const String &name);
+// Removes objects whose owner died before unlinking them. rdm calls this
+// when it starts.
+void sweep();
+
+// Buffers smaller than Threshold are serialized inline, larger ones are
+// published and only their name and size go into the stream. The segments
+// have to stay alive until rp has read them.
+void encodeUnsavedFiles(Serializer &serializer, const UnsavedFiles &unsavedFiles,
+                        List<std::shared_ptr<Segment> > &segments);
+bool decodeUnsavedFiles(Deserializer &deserializer, UnsavedFiles &unsavedFiles, String *error = 0);
+}
+
+#endif
@@ -0,0 +1,87 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include "StringPool.h"
+
+#include <algorithm>
+#include <string.h>
+
+static inline uint32_t hashString(const char *str, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i=0; i<len; ++i) {
+        hash ^= static_cast<unsigned char>(str[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+StringPool::StringPool()
+    : mPos(0), mAvailable(0), mBytesAllocated(0)
+{
+    mBuckets.resize(1024, 0);
+}
+
+uint32_t StringPool::intern(const char *str, size_t len)
+{
+    const uint32_t hash = hashString(str, len);
+    const size_t mask = mBuckets.size() - 1;
+    size_t bucket = hash & mask;
+    while (const uint32_t slot = mBuckets[bucket]) {
+        const Entry &entry = mEntries[slot - 1];
+        if (entry.hash == hash && entry.size == len && !memcmp(entry.data, str, len))
+            return slot - 1;
+        bucket = (bucket + 1) & mask;
+    }
+
+    char *data = allocate(len);
+    if (len)
+        memcpy(data, str, len);
+    const uint32_t id = mEntries.size();
+    mEntries.push_back({ data, static_cast<uint32_t>(len), hash });
+    mBuckets[bucket] = id + 1;
+    if (mEntries.size() * 2 > mBuckets.size())
+        rehash(mBuckets.size() * 2);
+    return id;
+}
+
+char *StringPool::allocate(size_t size)
+{
+    if (size > mAvailable) {
+        // strings larger than a block get a block of their own
+        const size_t blockSize = std::max<size_t>(size, BlockSize);
+        mBlocks.emplace_back(new char[blockSize]);
+        mPos = mBlocks.back().get();
+        mAvailable = blockSize;
+        mBytesAllocated += blockSize;
+    }
+    char *ret = mPos;
+    mPos += size;
+    mAvailable -= size;
+    return ret;
+}
+
+void StringPool::rehash(size_t bucketCount)
+{
+    mBuckets.assign(bucketCount, 0);
+    const size_t mask = bucketCount - 1;
+    for (size_t i=0; i<mEntries.size(); ++i) {
+        size_t bucket = mEntries[i].hash & mask;
+        while (mBuckets[bucket])
+            bucket = (bucket + 1) & mask;
+        mBuckets[bucket] = i + 1;
+    }
+}
@@ -0,0 +1,65 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef StringPool_h
+#define StringPool_h
+
+#include <assert.h>
+#include <cstdint>
+#include <memory>
+#include <string.h>
+#include <vector>
+
+#include "rct/String.h"
+
+// Interns strings into a bump arena that lives as long as the pool. Every
+// ClangIndexer, i.e. every rp job, has one so the usrs and names it sees
+// over and over again are stored once and referred to by a 32 bit id.
+class StringPool
+{
+public:
+    StringPool();
+
+    uint32_t intern(const char *str, size_t len);
+    uint32_t intern(const char *str) { return intern(str, strlen(str)); }
+    uint32_t intern(const String &string) { return intern(string.constData(), string.size()); }
+
+    const char *data(uint32_t id) const { assert(id < mEntries.size()); return mEntries[id].data; }
+    size_t size(uint32_t id) const { assert(id < mEntries.size()); return mEntries[id].size; }
+    String string(uint32_t id) const { return String(data(id), size(id)); }
+
+    size_t count() const { return mEntries.size(); }
+    size_t bytesAllocated() const { return mBytesAllocated; }
+private:
+    StringPool(const StringPool &) = delete;
+    StringPool &operator=(const StringPool &) = delete;
+
+    enum { BlockSize = 64 * 1024 };
+    char *allocate(size_t size);
+    void rehash(size_t bucketCount);
+
+    struct Entry {
+        const char *data;
+        uint32_t size;
+        uint32_t hash;
+    };
+    std::vector<Entry> mEntries;
+    std::vector<uint32_t> mBuckets; // id + 1, 0 is empty
+    std::vector<std::unique_ptr<char[]> > mBlocks;
+    char *mPos;
+    size_t mAvailable, mBytesAllocated;
+};
+
+#endif
@@ -18,7 +18,10 @@
 
 #include <rct/String.h>
 #include <rct/List.h>
+#include <assert.h>
 #include <cctype>
+#include <cstdint>
+#include <string.h>
 #include <algorithm>
 
 enum MatchResultType {
@@ -33,7 +36,7 @@ enum MatchResultType {
 struct CompletionCandidate
 {
     CompletionCandidate()
-        : priority(-1)
+        : priority(-1), word_starts(0), skipped(0), has_word_boundaries(false)
     {
     }
 
@@ -44,6 +47,13 @@ struct CompletionCandidate
     String brief_comment;
     String annotation;
     int priority;
+
+    /* Bit i of word_starts is set if name[i] starts a part of the word as
+     * split by break_parts_of_word, skipped has the characters that aren't in
+     * any part. Computed on first use, names longer than 64 characters don't
+     * get them and are matched the slow way. */
+    uint64_t word_starts, skipped;
+    bool has_word_boundaries;
 };
 
 struct MatchResult
@@ -98,7 +108,13 @@ struct MatchResultComparator
         if (a->candidate->priority != b->candidate->priority)
             return a->candidate->priority < b->candidate->priority;
 
-        return a < b;
+        /* Ties have to break the same way every time or --max-completions
+         * keeps a different set for the same query. The candidates live in
+         * one array, so their addresses are the order clang gave them in. */
+        const int cmp = a->candidate->name.compare(b->candidate->name);
+        if (cmp)
+            return cmp < 0;
+        return a->candidate < b->candidate;
     }
 };
 
@@ -108,12 +124,43 @@ public:
     static inline List<String> break_parts_of_word(const String &str);
     static inline size_t common_prefix(const String &str1, const String &str2);
     static inline std::unique_ptr<MatchResult> find_match(CompletionCandidate *candidate, const String &query);
+    static inline bool word_boundaries(const String &str, uint64_t *starts, uint64_t *skipped);
     static inline bool is_boundary_match(const List<String> &parts, const String &query, List<size_t> &indices);
     static inline String find_identifier_prefix(const String &line, size_t column, size_t *start);
-    static inline List<std::unique_ptr<MatchResult> > find_and_sort_matches(List<CompletionCandidate *> &candidates, const String &query);
+    // max == 0 means all of them
+    static inline List<std::unique_ptr<MatchResult> > find_and_sort_matches(List<CompletionCandidate *> &candidates, const String &query, size_t max = 0);
 
 private:
     StringTokenizer() = delete;
+
+    /* The query in the forms find_match compares against, made once per
+     * find_and_sort_matches rather than once per candidate. */
+    struct Query
+    {
+        Query(const String &q)
+            : query(q), lower(q.toLower()), stripped(lower)
+        {
+            stripped.erase(std::remove_if(stripped.begin(), stripped.end(), [](char c) { return !isalnum(static_cast<unsigned char>(c)); }),
+                           stripped.end());
+        }
+
+        const String &query;
+        String lower, stripped;
+    };
+
+    static inline std::unique_ptr<MatchResult> find_match(CompletionCandidate *candidate, const Query &query);
+    static inline bool is_boundary_match(const CompletionCandidate *candidate,
+                                         const String &query,
+                                         List<size_t> &indices);
+    static inline bool is_boundary_match(const String &name,
+                                         const uint8_t *part_starts,
+                                         const uint8_t *part_ends,
+                                         size_t part_count,
+                                         uint64_t skipped,
+                                         const String &query,
+                                         uint8_t *counts,
+                                         size_t query_start,
+                                         size_t current_index);
     static inline bool is_boundary_match(const List<String> &parts,
                                          const String &query,
                                          List<size_t> &indices,
@@ -188,30 +235,154 @@ size_t StringTokenizer::common_prefix(const String &str1, const String &str2)
 
 std::unique_ptr<MatchResult> StringTokenizer::find_match(CompletionCandidate *candidate, const String &query)
 {
-    String c = candidate->name;
-
-    if (query.length() > c.length())
-        return 0;
+    return find_match(candidate, Query(query));
+}
 
-    String c_lower = c.toLower();
-    String query_lower = query.toLower();
+std::unique_ptr<MatchResult> StringTokenizer::find_match(CompletionCandidate *candidate, const Query &query)
+{
+    const String &c = candidate->name;
+    const size_t length = query.query.length();
 
-    bool are_equal = c.length() == query.length();
-    if (equal(query.begin(), query.end(), c.begin()))
-        return std::unique_ptr<MatchResult>(new PrefixResult(are_equal ? EXACT_MATCH_CASE_SENSITIVE : PREFIX_MATCH_CASE_SENSITIVE, candidate, query.length()));
+    if (length > c.length())
+        return 0;
 
-    if (equal(query_lower.begin(), query_lower.end(), c_lower.begin()))
-        return std::unique_ptr<MatchResult>(new PrefixResult(are_equal ? EXACT_MATCH_CASE_INSENSITIVE : PREFIX_MATCH_CASE_INSENSITIVE, candidate, query.length()));
+    bool are_equal = c.length() == length;
+    if (!memcmp(query.query.constData(), c.constData(), length))
+        return std::unique_ptr<MatchResult>(new PrefixResult(are_equal ? EXACT_MATCH_CASE_SENSITIVE : PREFIX_MATCH_CASE_SENSITIVE, candidate, length));
+
+    const char *lower = query.lower.constData();
+    size_t i = 0;
+    while (i < length && tolower(static_cast<unsigned char>(c[i])) == lower[i])
+        ++i;
+    if (i == length)
+        return std::unique_ptr<MatchResult>(new PrefixResult(are_equal ? EXACT_MATCH_CASE_INSENSITIVE : PREFIX_MATCH_CASE_INSENSITIVE, candidate, length));
+
+    if (!candidate->has_word_boundaries) {
+        if (!word_boundaries(c, &candidate->word_starts, &candidate->skipped)) {
+            List<String> words = StringTokenizer::break_parts_of_word(c);
+            List<size_t> indices;
+            bool r = is_boundary_match(words, query.lower, indices);
+            if (r)
+                return std::unique_ptr<MatchResult>(new WordBoundaryMatchResult(candidate, indices));
+            return std::unique_ptr<MatchResult>();
+        }
+        candidate->has_word_boundaries = true;
+    }
 
-    List<String> words = StringTokenizer::break_parts_of_word(c);
     List<size_t> indices;
-    bool r = is_boundary_match(words, query_lower, indices);
-    if (r)
+    if (is_boundary_match(candidate, query.stripped, indices))
         return std::unique_ptr<MatchResult>(new WordBoundaryMatchResult(candidate, indices));
 
     return std::unique_ptr<MatchResult>();
 }
 
+/* Same splitting rules as break_parts_of_word without building the parts. */
+bool StringTokenizer::word_boundaries(const String &str, uint64_t *starts, uint64_t *skipped)
+{
+    if (str.size() > 64)
+        return false;
+
+    *starts = *skipped = 0;
+    size_t buffer_length = 0, last_pos = 0;
+    unsigned char last = 0;
+    for (size_t i = 0; i < str.size(); i++) {
+        const unsigned char c = str[i];
+        if (c == '_') {
+            *skipped |= (1ull << i);
+            buffer_length = 0;
+            continue;
+        } else if (islower(c)) {
+            if (buffer_length > 1 && isupper(last)) {
+                /* Break: XML|Do. */
+                *starts |= (1ull << last_pos);
+                buffer_length = 1;
+            } else if (buffer_length && isdigit(last)) {
+                /* Break: 0|D. */
+                buffer_length = 0;
+            }
+        } else if (isupper(c)) {
+            /* Break: a|D or 0|D. */
+            if (buffer_length && !isupper(last))
+                buffer_length = 0;
+        } else if (isdigit(c)) {
+            /* Break: a|0 or A|0. */
+            if (buffer_length && !isdigit(last))
+                buffer_length = 0;
+        } else {
+            *skipped |= (1ull << i);
+            continue;
+        }
+
+        if (!buffer_length)
+            *starts |= (1ull << i);
+        ++buffer_length;
+        last = c;
+        last_pos = i;
+    }
+    return true;
+}
+
+bool StringTokenizer::is_boundary_match(const CompletionCandidate *candidate, const String &query, List<size_t> &indices)
+{
+    assert(candidate->has_word_boundaries);
+    uint8_t part_starts[64], part_ends[64];
+    size_t part_count = 0;
+    for (uint64_t starts = candidate->word_starts; starts; starts &= starts - 1) {
+        const uint8_t pos = __builtin_ctzll(starts);
+        if (part_count)
+            part_ends[part_count - 1] = pos;
+        part_starts[part_count++] = pos;
+    }
+    if (part_count)
+        part_ends[part_count - 1] = candidate->name.size();
+
+    uint8_t counts[64];
+    if (!is_boundary_match(candidate->name, part_starts, part_ends, part_count, candidate->skipped, query, counts, 0, 0))
+        return false;
+    indices.resize(part_count);
+    for (size_t i = 0; i < part_count; i++)
+        indices[i] = counts[i];
+    return true;
+}
+
+bool StringTokenizer::is_boundary_match(const String &name,
+                                        const uint8_t *part_starts,
+                                        const uint8_t *part_ends,
+                                        size_t part_count,
+                                        uint64_t skipped,
+                                        const String &query,
+                                        uint8_t *counts,
+                                        size_t query_start,
+                                        size_t current_index)
+{
+    if (query_start == query.length()) {
+        /* The parts we didn't get to matched nothing. */
+        std::fill(counts + current_index, counts + part_count, 0);
+        return true;
+    } else if (current_index == part_count) {
+        return false;
+    }
+
+    size_t longest_prefix = 0;
+    for (size_t pos = part_starts[current_index]; pos < part_ends[current_index]; pos++) {
+        if (skipped & (1ull << pos))
+            continue;
+        if (query_start + longest_prefix == query.length()
+            || tolower(static_cast<unsigned char>(name[pos])) != query[query_start + longest_prefix])
+            break;
+        longest_prefix++;
+    }
+
+    for (int i = longest_prefix; i >= 0; i--) {
+        counts[current_index] = i;
+        bool r = is_boundary_match(name, part_starts, part_ends, part_count, skipped, query, counts, query_start + i, current_index + 1);
+        if (r)
+            return r;
+    }
+
+    return false;
+}
+
 static bool isnotalnum(char c)
 {
     return !isalnum(c);
@@ -251,18 +422,38 @@ bool StringTokenizer::is_boundary_match(const List<String> &parts,
     return false;
 }
 
-List<std::unique_ptr<MatchResult> > StringTokenizer::find_and_sort_matches(List<CompletionCandidate *> &candidates, const String &query)
+List<std::unique_ptr<MatchResult> > StringTokenizer::find_and_sort_matches(List<CompletionCandidate *> &candidates, const String &query, size_t max)
 {
     List<std::unique_ptr<MatchResult> > results;
+    const Query q(query);
+
+    if (!max || max >= candidates.size()) {
+        for (List<CompletionCandidate *>::const_iterator c = candidates.begin(); c != candidates.end(); c++) {
+            std::unique_ptr<MatchResult> r = find_match(*c, q);
+            if (r) {
+                results.push_back(std::move(r));
+            }
+        }
 
+        sort(results.begin(), results.end(), MatchResultComparator());
+        return results;
+    }
+
+    /* Keep the best max matches in a heap with the worst one on top. */
+    results.reserve(max + 1);
     for (List<CompletionCandidate *>::const_iterator c = candidates.begin(); c != candidates.end(); c++) {
-        std::unique_ptr<MatchResult> r = find_match(*c, query);
+        std::unique_ptr<MatchResult> r = find_match(*c, q);
         if (r) {
             results.push_back(std::move(r));
+            push_heap(results.begin(), results.end(), MatchResultComparator());
+            if (results.size() > max) {
+                pop_heap(results.begin(), results.end(), MatchResultComparator());
+                results.pop_back();
+            }
         }
     }
 
-    sort(results.begin(), results.end(), MatchResultComparator());
+    sort_heap(results.begin(), results.end(), MatchResultComparator());
 
     return results;
 }
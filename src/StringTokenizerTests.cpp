@@ -1,3 +1,4 @@
+#include "CompletionThread.h"
 #include "StringTokenizer.h"
 
 TEST (StringTokenizerTest, BreakIdentifierWithUnderscore)
@@ -211,19 +212,120 @@ TEST (StringTokenizerTest, FindMatchWordBoundary)
     delete wbm;
 }
 
-static vector<MatchResult *> test_find_and_sort_matches(vector<string> &candidate_names, const string &query)
+static CompletionCandidate make_candidate(const String &name)
 {
-    vector<CompletionCandidate *> candidates;
+    CompletionCandidate candidate;
+    candidate.name = name;
+    return candidate;
+}
+
+/* The parts word_boundaries describes, they have to be the ones
+ * break_parts_of_word makes. */
+static List<String> test_word_boundaries(const String &name)
+{
+    List<String> parts;
+    uint64_t starts, skipped;
+    if (!StringTokenizer::word_boundaries(name, &starts, &skipped))
+        return parts;
+    for (size_t i = 0; i < name.size(); i++) {
+        if (starts & (1ull << i))
+            parts.push_back(String());
+        if (!(skipped & (1ull << i)))
+            parts.back() += static_cast<char>(tolower(name[i]));
+    }
+    return parts;
+}
+
+TEST (StringTokenizerTest, WordBoundariesSameAsBreakPartsOfWord)
+{
+    const char *names[] = {
+        "my_shiny_identifier", "MyShinyXYZIdentifier", "foo12345bar", "12345FooBar",
+        "XYZ12345XMLDocument", "XYZ12345XM_LDocument", "XMLDocument", "Foo0Dbar",
+        "foo$bar_baz", "operator==", "a__b", "_leading", "trailing_", "A", ""
+    };
+    for (const char *name : names)
+        ASSERT_EQ(StringTokenizer::break_parts_of_word(name), test_word_boundaries(name)) << name;
+}
+
+TEST (StringTokenizerTest, WordBoundariesLongName)
+{
+    uint64_t starts, skipped;
+    CompletionCandidate candidate = make_candidate("get_a_really_long_name_that_goes_on_and_on_past_the_sixty_four_limit");
+    ASSERT_TRUE(candidate.name.size() > 64);
+    ASSERT_FALSE(StringTokenizer::word_boundaries(candidate.name, &starts, &skipped));
+
+    /* Matched the slow way */
+    auto r = StringTokenizer::find_match(&candidate, "garl");
+    ASSERT_TRUE(r != nullptr);
+    ASSERT_EQ (WORD_BOUNDARY_MATCH, r->type);
+    ASSERT_FALSE(candidate.has_word_boundaries);
+
+    WordBoundaryMatchResult *wbm = static_cast<WordBoundaryMatchResult *> (r.get());
+    ASSERT_EQ (1, wbm->indices[0]);
+    ASSERT_EQ (1, wbm->indices[1]);
+    ASSERT_EQ (1, wbm->indices[2]);
+    ASSERT_EQ (1, wbm->indices[3]);
+    ASSERT_EQ (0, wbm->indices[4]);
+}
+
+TEST (StringTokenizerTest, FindMatchWordBoundaryUpperCaseRun)
+{
+    /* XML|Do */
+    CompletionCandidate candidate = make_candidate("XMLDocument");
+    auto r = StringTokenizer::find_match(&candidate, "xd");
+    ASSERT_EQ (WORD_BOUNDARY_MATCH, r->type);
+
+    WordBoundaryMatchResult *wbm = static_cast<WordBoundaryMatchResult *> (r.get());
+    ASSERT_EQ (2, wbm->indices.size());
+    ASSERT_EQ (1, wbm->indices[0]);
+    ASSERT_EQ (1, wbm->indices[1]);
+}
+
+TEST (StringTokenizerTest, FindMatchWordBoundaryDigitRun)
+{
+    /* 0|D */
+    CompletionCandidate candidate = make_candidate("Foo0Document");
+    auto r = StringTokenizer::find_match(&candidate, "f0d");
+    ASSERT_EQ (WORD_BOUNDARY_MATCH, r->type);
+
+    WordBoundaryMatchResult *wbm = static_cast<WordBoundaryMatchResult *> (r.get());
+    ASSERT_EQ (3, wbm->indices.size());
+    ASSERT_EQ (1, wbm->indices[0]);
+    ASSERT_EQ (1, wbm->indices[1]);
+    ASSERT_EQ (1, wbm->indices[2]);
+}
+
+TEST (StringTokenizerTest, FindMatchWordBoundaryInnerNonAlnum)
+{
+    /* '$' doesn't end a part, the part is "foobar" */
+    CompletionCandidate candidate = make_candidate("foo$bar_baz");
+    auto r = StringTokenizer::find_match(&candidate, "foobb");
+    ASSERT_EQ (WORD_BOUNDARY_MATCH, r->type);
+
+    WordBoundaryMatchResult *wbm = static_cast<WordBoundaryMatchResult *> (r.get());
+    ASSERT_EQ (2, wbm->indices.size());
+    ASSERT_EQ (4, wbm->indices[0]);
+    ASSERT_EQ (1, wbm->indices[1]);
+
+    List<size_t> indices;
+    ASSERT_TRUE(StringTokenizer::is_boundary_match(StringTokenizer::break_parts_of_word(candidate.name), "foobb", indices));
+    ASSERT_EQ (wbm->indices, indices);
+}
+
+static List<std::unique_ptr<MatchResult> > test_find_and_sort_matches(vector<string> &candidate_names, const string &query,
+                                                                     size_t max = 0)
+{
+    List<CompletionCandidate *> candidates;
     for(unsigned i = 0; i < candidate_names.size(); i++)
-        candidates.push_back(new CompletionCandidate(candidate_names[i]));
+        candidates.push_back(new CompletionCandidate(make_candidate(candidate_names[i].c_str())));
 
-    return StringTokenizer::find_and_sort_matches(candidates, query);
+    return StringTokenizer::find_and_sort_matches(candidates, query, max);
 }
 
 TEST (StringTokenizerTest, FindAndSortResultsSimple)
 {
     vector<string> names = {"foo", "bar", "baz"};
-    vector<MatchResult *> results = test_find_and_sort_matches(names, "fo");
+    auto results = test_find_and_sort_matches(names, "fo");
 
     ASSERT_EQ(1, results.size());
     ASSERT_EQ(PREFIX_MATCH_CASE_SENSITIVE, results[0]->type);
@@ -233,7 +335,7 @@ TEST (StringTokenizerTest, FindAndSortResultsSimple)
 TEST (StringTokenizerTest, FindAndSortResultsSimpleMultiple)
 {
     vector<string> names = {"foo", "fredy", "baz", "f"};
-    vector<MatchResult *> results = test_find_and_sort_matches(names, "f");
+    auto results = test_find_and_sort_matches(names, "f");
 
     ASSERT_EQ(3, results.size());
     ASSERT_EQ("f", results[0]->candidate->name);
@@ -247,7 +349,7 @@ TEST (StringTokenizerTest, FindAndSortResultsSimpleMultiple)
 TEST (StringTokenizerTest, FindAndSortResultsCaseSensitivity)
 {
     vector<string> names = {"Fr", "Fredy", "Baz", "franko", "fr"};
-    vector<MatchResult *> results = test_find_and_sort_matches(names, "Fr");
+    auto results = test_find_and_sort_matches(names, "Fr");
 
     ASSERT_EQ(4, results.size());
     ASSERT_EQ("Fr", results[0]->candidate->name);
@@ -263,7 +365,7 @@ TEST (StringTokenizerTest, FindAndSortResultsCaseSensitivity)
 TEST (StringTokenizerTest, FindAndSortResultsCaseMixture)
 {
     vector<string> names = {"fbar", "f_call_bar", "from_bar_and_read", "gnome", "", "ffbar"};
-    vector<MatchResult *> results = test_find_and_sort_matches(names, "fbar");
+    auto results = test_find_and_sort_matches(names, "fbar");
 
     ASSERT_EQ(3, results.size());
     ASSERT_EQ(EXACT_MATCH_CASE_SENSITIVE, results[0]->type);
@@ -274,10 +376,20 @@ TEST (StringTokenizerTest, FindAndSortResultsCaseMixture)
     ASSERT_EQ("f_call_bar", results[2]->candidate->name);
 }
 
+TEST (StringTokenizerTest, FindAndSortResultsMax)
+{
+    vector<string> names = {"foo", "fredy", "baz", "f"};
+    auto results = test_find_and_sort_matches(names, "f", 2);
+
+    ASSERT_EQ(2, results.size());
+    ASSERT_EQ("f", results[0]->candidate->name);
+    ASSERT_EQ("foo", results[1]->candidate->name);
+}
+
 TEST (StringTokenizerTest, FindAndSortResultsLongerPrefixAtBeginning)
 {
     vector<string> names = {"get_long_value_with_very_nice", "gloooveshark", "get_small_and_long", "gl_o"};
-    vector<MatchResult *> results = test_find_and_sort_matches(names, "glo");
+    auto results = test_find_and_sort_matches(names, "glo");
 
     ASSERT_EQ(4, results.size());
     ASSERT_EQ("gloooveshark", results[0]->candidate->name);
@@ -286,6 +398,19 @@ TEST (StringTokenizerTest, FindAndSortResultsLongerPrefixAtBeginning)
     ASSERT_EQ("get_small_and_long", results[3]->candidate->name);
 }
 
+TEST (CompletionThreadTest, ContextHashIgnoresPrefix)
+{
+    /* "fo" after "f" at the same spot is refiltered, not completed again */
+    const String f = "int main()\n{\n    f\n}\n";
+    const String fo = "int main()\n{\n    fo\n}\n";
+    const size_t start = CompletionThread::offset(f, 3, 5);
+    ASSERT_EQ (start, CompletionThread::offset(fo, 3, 5));
+    ASSERT_EQ (CompletionThread::contextHash(f, start, 1), CompletionThread::contextHash(fo, start, 2));
+
+    /* Changes anywhere else mean completing again */
+    const String changed = "int main()\n{\n    fo;\n}\n";
+    ASSERT_NE (CompletionThread::contextHash(fo, start, 2), CompletionThread::contextHash(changed, start, 2));
+}
 
 int main(int argc, char **argv)
 {
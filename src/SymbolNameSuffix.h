@@ -0,0 +1,94 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef SymbolNameSuffix_h
+#define SymbolNameSuffix_h
+
+#include <algorithm>
+#include <assert.h>
+#include <cstdint>
+
+#include "rct/String.h"
+
+// The symnames file only holds the canonical names of each declaration,
+// e.g. "int ns::Foo::bar(int)". All the names you can look it up by
+// ("Foo::bar(int)", "bar(int)", "int bar(int)" and so on) are entries in the
+// symsuffixes file, sorted by the name they describe. An entry is the index of
+// a canonical name plus the length of the type prefix to keep and the offset
+// where the suffix starts, the name is key[0, typeLength) + key[offset, end).
+namespace SymbolNameSuffix {
+enum {
+    OffsetBits = 20,
+    TypeLengthBits = 12,
+    MaxOffset = (1 << OffsetBits) - 1,
+    MaxTypeLength = (1 << TypeLengthBits) - 1
+};
+
+inline uint64_t pack(uint32_t keyIndex, uint32_t offset, uint32_t typeLength)
+{
+    assert(offset <= MaxOffset);
+    assert(typeLength <= MaxTypeLength);
+    return (static_cast<uint64_t>(keyIndex) << 32) | (offset << TypeLengthBits) | typeLength;
+}
+
+inline uint32_t keyIndex(uint64_t entry) { return static_cast<uint32_t>(entry >> 32); }
+inline uint32_t offset(uint64_t entry) { return static_cast<uint32_t>(entry >> TypeLengthBits) & MaxOffset; }
+inline uint32_t typeLength(uint64_t entry) { return static_cast<uint32_t>(entry) & MaxTypeLength; }
+
+struct Name
+{
+    Name(const String &key, uint64_t entry)
+        : head(key.constData()), headLength(std::min<size_t>(typeLength(entry), key.size())),
+          tail(key.constData() + std::min<size_t>(offset(entry), key.size())),
+          tailLength(key.size() - std::min<size_t>(offset(entry), key.size()))
+    {}
+    Name(const String &string)
+        : head(string.constData()), headLength(string.size()), tail(0), tailLength(0)
+    {}
+
+    size_t size() const { return headLength + tailLength; }
+    unsigned char at(size_t idx) const
+    {
+        return idx < headLength ? head[idx] : tail[idx - headLength];
+    }
+    String toString() const
+    {
+        String ret(head, headLength);
+        ret.append(tail, tailLength);
+        return ret;
+    }
+
+    const char *head;
+    size_t headLength;
+    const char *tail;
+    size_t tailLength;
+};
+
+// Same order as String::compare
+inline int compare(const Name &l, const Name &r)
+{
+    const size_t count = std::min(l.size(), r.size());
+    for (size_t i=0; i<count; ++i) {
+        const unsigned char lc = l.at(i), rc = r.at(i);
+        if (lc != rc)
+            return lc < rc ? -1 : 1;
+    }
+    if (l.size() != r.size())
+        return l.size() < r.size() ? -1 : 1;
+    return 0;
+}
+}
+
+#endif
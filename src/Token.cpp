@@ -1,5 +1,7 @@
 #include "Token.h"
 
+#include <algorithm>
+
 String Token::toString() const
 {
     String ret;
@@ -21,3 +23,28 @@ String Token::toString() const
     return ret;
 
 }
+
+TokenDecoder::TokenDecoder(uint32_t fileId, const String &contents)
+    : mFileId(fileId), mContents(contents)
+{
+    mLines.append(0);
+    const char *data = mContents.constData();
+    for (size_t i=0; i<mContents.size(); ++i) {
+        if (data[i] == '\n')
+            mLines.append(i + 1);
+    }
+}
+
+Token TokenDecoder::decode(uint32_t offset, uint32_t value) const
+{
+    Token ret;
+    ret.kind = Token::kind(value);
+    ret.offset = offset;
+    ret.length = Token::length(value);
+    if (offset + ret.length <= mContents.size())
+        ret.spelling.assign(mContents.constData() + offset, ret.length);
+    const auto it = std::upper_bound(mLines.begin(), mLines.end(), offset);
+    const uint32_t line = it - mLines.begin();
+    ret.location = Location(mFileId, line, offset - *(it - 1) + 1);
+    return ret;
+}
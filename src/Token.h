@@ -16,6 +16,7 @@
 #ifndef Token_h
 #define Token_h
 
+#include "rct/List.h"
 #include "rct/Serializer.h"
 #include "rct/Log.h"
 #include "Location.h"
@@ -29,6 +30,26 @@ struct Token
     uint32_t offset, length;
 
     String toString() const;
+
+    // The tokens file is a FileMap<uint32_t, uint32_t> from offset to
+    // kind and length. Spelling and location come from the source.
+    enum { KindBits = 3 };
+    static uint32_t encode(CXTokenKind kind, uint32_t length) { return (length << KindBits) | kind; }
+    static CXTokenKind kind(uint32_t value) { return static_cast<CXTokenKind>(value & ((1 << KindBits) - 1)); }
+    static uint32_t length(uint32_t value) { return value >> KindBits; }
+};
+
+// Turns the entries of one file's tokens file back into Tokens
+class TokenDecoder
+{
+public:
+    TokenDecoder(uint32_t fileId, const String &contents);
+
+    Token decode(uint32_t offset, uint32_t value) const;
+private:
+    const uint32_t mFileId;
+    const String mContents;
+    List<uint32_t> mLines;
 };
 
 template <> inline Serializer &operator<<(Serializer &s, const Token &t)
@@ -39,27 +39,69 @@ int TokensJob::execute()
     if (!map)
         return 2;
 
+    String contents = proj->unsavedFile(mFileId);
+    if (contents.isEmpty())
+        contents = Location::path(mFileId).readAll();
+    const TokenDecoder decoder(mFileId, contents);
+
     const uint32_t count = map->count();
     uint32_t i = 0;
     if (mFrom != 0) {
         i = map->lowerBound(mFrom);
         if (i > 0 && i < count) {
-            const Token val = map->valueAt(i - 1);
-            if (val.offset + val.length >= mFrom)
+            if (map->keyAt(i - 1) + Token::length(map->valueAt(i - 1)) >= mFrom)
                 --i;
         }
     }
 
+    const uint32_t end = map->upperBound(mTo);
+
+    // Tokens and symbols are both sorted by location so the symbols are
+    // walked alongside the tokens rather than looked up for each of them.
+    std::shared_ptr<FileMap<Location, Symbol> > symbols;
+    FileMap<Location, Symbol>::Range symbolRange = { 0, 0 };
+    if (queryFlags() & QueryMessage::Elisp && queryFlags() & QueryMessage::TokensIncludeSymbols && i < end) {
+        symbols = proj->openSymbols(mFileId);
+        if (symbols && symbols->count()) {
+            const Location first = decoder.decode(map->keyAt(i), map->valueAt(i)).location;
+            const Location last = decoder.decode(map->keyAt(end - 1), map->valueAt(end - 1)).location;
+            symbolRange = symbols->range(first, last);
+            // the symbol under the first token may start before it
+            if (symbolRange.begin)
+                --symbolRange.begin;
+        }
+    }
+    uint32_t symbolIndex = symbolRange.begin;
+    uint32_t cachedIndex = std::numeric_limits<uint32_t>::max();
+    Symbol cached;
+    // Same match as Project::findSymbol
+    auto findSymbol = [&](Location location) {
+        if (symbolRange.isEmpty())
+            return Symbol();
+        while (symbolIndex + 1 < symbolRange.end && symbols->keyAt(symbolIndex + 1) <= location)
+            ++symbolIndex;
+        const Location key = symbols->keyAt(symbolIndex);
+        if (key > location || key.fileId() != location.fileId() || key.line() != location.line())
+            return Symbol();
+        if (cachedIndex != symbolIndex) {
+            cached = symbols->valueAt(symbolIndex);
+            cachedIndex = symbolIndex;
+        }
+        if (key != location && location.column() - key.column() >= cached.symbolLength)
+            return Symbol();
+        return cached;
+    };
+
     std::function<bool(const Token &)> writeToken;
     if (queryFlags() & QueryMessage::Elisp) {
         const char *elispFormat = "(cons %d (list (cons 'length %d) (cons 'kind \"%s\") (cons 'spelling \"%s\")))";
         write("(list");
         if (queryFlags() & QueryMessage::TokensIncludeSymbols) {
-            writeToken = [this, &proj, elispFormat](const Token &token) {
+            writeToken = [this, &findSymbol, elispFormat](const Token &token) {
                 String out = String::format<1024>(elispFormat,
                                                   token.offset, token.length, RTags::tokenKindSpelling(token.kind),
                                                   RTags::elispEscape(token.spelling).constData());
-                const Symbol sym = proj->findSymbol(token.location);
+                const Symbol sym = findSymbol(token.location);
                 if (!sym.isNull()) {
                     out.chop(2);
                     out << " (cons 'symbol ";
@@ -85,10 +127,9 @@ int TokensJob::execute()
         };
     }
 
-    while (i < count) {
-        const Token token = map->valueAt(i++);
-        if (token.offset > mTo)
-            break;
+    while (i < end) {
+        const Token token = decoder.decode(map->keyAt(i), map->valueAt(i));
+        ++i;
         if (!writeToken(token))
             return 4;
     }
@@ -0,0 +1,145 @@
+/* This file is part of RTags (http://rtags.net).
+
+   RTags is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   RTags is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with RTags.  If not, see <http://www.gnu.org/licenses/>. */
+
+#ifndef UnitManifest_h
+#define UnitManifest_h
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rct/Map.h"
+#include "rct/Path.h"
+#include "rct/Serializer.h"
+#include "rct/String.h"
+#include "RTags.h"
+
+// rp writes one of these next to the file maps of every unit it indexed,
+// after the maps themselves. It records which job wrote them and the size
+// and entry count of each map so rdm can tell that a job left a complete
+// unit behind by reading this one small file instead of mapping them all.
+// rp removes the old manifest before it touches the maps so a job that dies
+// half way never leaves a manifest for files it didn't finish.
+class UnitManifest
+{
+public:
+    struct Entry {
+        uint64_t size;
+        uint32_t count;
+    };
+
+    UnitManifest()
+        : mGeneration(0)
+    {}
+
+    static const char *fileName() { return "manifest"; }
+
+    uint64_t generation() const { return mGeneration; }
+    void setGeneration(uint64_t generation) { mGeneration = generation; }
+    // Job ids start over with every rdm, the parse time keeps a manifest
+    // left by an earlier run from matching a job with the same id
+    static uint64_t generation(uint64_t jobId, uint64_t parseTime)
+    {
+        const uint64_t hash = RTags::fnv1a(reinterpret_cast<const char *>(&jobId), sizeof(jobId));
+        return RTags::fnv1a(reinterpret_cast<const char *>(&parseTime), sizeof(parseTime), hash);
+    }
+
+    void insert(const String &name, uint64_t size, uint32_t count) { mEntries[name] = { size, count }; }
+    bool contains(const String &name) const { return mEntries.contains(name); }
+    Entry entry(const String &name) const { return mEntries.value(name, Entry({ 0, 0 })); }
+    const Map<String, Entry> &entries() const { return mEntries; }
+
+    // Written to a temporary file and renamed into place
+    bool write(const Path &path, String *error = 0) const
+    {
+        String data;
+        {
+            Serializer serializer(data);
+            serializer << static_cast<uint16_t>(RTags::DatabaseVersion) << mGeneration
+                       << static_cast<uint32_t>(mEntries.size());
+            for (const auto &it : mEntries)
+                serializer << it.first << it.second.size << it.second.count;
+        }
+        const uint64_t sum = checksum(data.constData(), data.size());
+        data.append(reinterpret_cast<const char*>(&sum), sizeof(sum));
+
+        Path tmp = path;
+        tmp << ".tmp";
+        FILE *f = fopen(tmp.constData(), "w");
+        if (!f) {
+            if (error)
+                *error = "Failed to open " + tmp;
+            return false;
+        }
+        const bool ok = fwrite(data.constData(), data.size(), 1, f);
+        fclose(f);
+        if (!ok) {
+            if (error)
+                *error = "Failed to write " + tmp;
+            Path::rm(tmp);
+            return false;
+        }
+        if (rename(tmp.constData(), path.constData())) {
+            if (error)
+                *error = "Failed to rename " + tmp;
+            Path::rm(tmp);
+            return false;
+        }
+        return true;
+    }
+
+    bool load(const Path &path, String *error = 0)
+    {
+        const String data = path.readAll();
+        if (data.size() < sizeof(uint64_t)) {
+            if (error)
+                *error = "Missing manifest " + path;
+            return false;
+        }
+        const size_t bodySize = data.size() - sizeof(uint64_t);
+        uint64_t sum;
+        memcpy(&sum, data.constData() + bodySize, sizeof(sum));
+        if (sum != checksum(data.constData(), bodySize)) {
+            if (error)
+                *error = "Corrupted manifest " + path;
+            return false;
+        }
+        Deserializer deserializer(data.constData(), bodySize);
+        uint16_t version;
+        deserializer >> version;
+        if (version != RTags::DatabaseVersion) {
+            if (error)
+                *error = String::format<128>("Wrong database version in manifest %s, %d vs %d",
+                                             path.constData(), version, RTags::DatabaseVersion);
+            return false;
+        }
+        uint32_t count;
+        deserializer >> mGeneration >> count;
+        mEntries.clear();
+        for (uint32_t i=0; i<count; ++i) {
+            String name;
+            Entry entry;
+            deserializer >> name >> entry.size >> entry.count;
+            mEntries[name] = entry;
+        }
+        return true;
+    }
+private:
+    static uint64_t checksum(const char *data, size_t size) { return RTags::fnv1a(data, size); }
+
+    uint64_t mGeneration;
+    Map<String, Entry> mEntries;
+};
+
+#endif
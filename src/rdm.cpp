@@ -83,6 +83,9 @@ static void signalHandler(int signal)
 #define DEFAULT_RP_CONNECT_TIMEOUT 0 // won't time out
 #define DEFAULT_RP_CONNECT_ATTEMPTS 3
 #define DEFAULT_COMPLETION_CACHE_SIZE 10
+#define DEFAULT_COMPLETION_THREADS 2
+#define DEFAULT_MAX_COMPLETIONS 0
+#define DEFAULT_COMPLETION_CACHE_MEMORY 4096
 #define DEFAULT_ERROR_LIMIT 50
 #define DEFAULT_MAX_INCLUDE_COMPLETION_DEPTH 3
 #define DEFAULT_MAX_CRASH_COUNT 5
@@ -208,6 +211,15 @@ enum OptionType {
     PollTimer,
     NoRealPath,
     TranslationUnitCache,
+    SegmentedStorage,
+    HeaderCoverageScheduling,
+    AdaptiveJobCount,
+    LazyTokens,
+    ResidentTranslationUnits,
+    CompletionThreads,
+    MaxCompletions,
+    CompletionCacheMemory,
+    SpeculativeCompletions,
     Noop
 };
 
@@ -246,6 +258,9 @@ int main(int argc, char** argv)
     serverOpts.options = Server::Wall|Server::SpellChecking;
     serverOpts.maxCrashCount = DEFAULT_MAX_CRASH_COUNT;
     serverOpts.completionCacheSize = DEFAULT_COMPLETION_CACHE_SIZE;
+    serverOpts.completionThreads = DEFAULT_COMPLETION_THREADS;
+    serverOpts.maxCompletions = DEFAULT_MAX_COMPLETIONS;
+    serverOpts.completionCacheMemory = DEFAULT_COMPLETION_CACHE_MEMORY;
     serverOpts.maxIncludeCompletionDepth = DEFAULT_MAX_INCLUDE_COMPLETION_DEPTH;
     serverOpts.rp = defaultRP();
     strcpy(crashDumpFilePath, "crash.dump");
@@ -357,6 +372,15 @@ int main(int argc, char** argv)
         { PollTimer, "poll-timer", 0, CommandLineParser::Required, "Poll the database of the current project every <arg> seconds. " },
         { NoRealPath, "no-realpath", 0, CommandLineParser::NoValue, "Don't use realpath(3) for files" },
         { TranslationUnitCache, "translation-unit-cache", 0, CommandLineParser::NoValue, "Cache translation units. Not working yet." },
+        { SegmentedStorage, "segmented-storage", 0, CommandLineParser::NoValue, "Store the project database in one append-only segment file instead of a directory per file." },
+        { HeaderCoverageScheduling, "header-coverage-scheduling", 0, CommandLineParser::NoValue, "Start the sources that include the most headers nobody has claimed yet first so later jobs can skip them." },
+        { AdaptiveJobCount, "adaptive-job-count", 0, CommandLineParser::NoValue, "Treat --job-count as a maximum and scale the number of rp processes with system load, free memory and pressure stall information." },
+        { LazyTokens, "lazy-tokens", 0, CommandLineParser::NoValue, "Don't tokenize files while indexing, do it the first time their tokens are queried." },
+        { ResidentTranslationUnits, "resident-translation-units", 0, CommandLineParser::NoValue, "Index active buffers in a long-running rp that keeps their translation units in memory and reparses them." },
+        { CompletionThreads, "completion-threads", 0, CommandLineParser::Required, "Number of threads doing completions, each one caches its share of --completion-cache-size translation units (default " STR(DEFAULT_COMPLETION_THREADS) ")." },
+        { MaxCompletions, "max-completions", 0, CommandLineParser::Required, "Max number of completions to send for a request, the best ones are kept. 0 means no limit (default " STR(DEFAULT_MAX_COMPLETIONS) ")." },
+        { CompletionCacheMemory, "completion-cache-memory", 0, CommandLineParser::Required, "Max MB of memory the cached completion translation units may use, as reported by clang. Units that are cheap to parse again per MB are evicted first. 0 means no limit (default " STR(DEFAULT_COMPLETION_CACHE_MEMORY) ")." },
+        { SpeculativeCompletions, "speculative-completions", 0, CommandLineParser::NoValue, "Warm up completions for recently visited buffers and the sources of included headers in the background." },
         { Noop, "config", 'c', CommandLineParser::Required, "Use this file (instead of ~/.rdmrc)." },
         { Noop, "no-rc", 'N', CommandLineParser::NoValue, "Don't load any rc files." }
     };
@@ -714,6 +738,42 @@ int main(int argc, char** argv)
         case TranslationUnitCache: {
             serverOpts.options |= Server::TranslationUnitCache;
             break; }
+        case SegmentedStorage: {
+            serverOpts.options |= Server::SegmentedStorage;
+            break; }
+        case HeaderCoverageScheduling: {
+            serverOpts.options |= Server::HeaderCoverageScheduling;
+            break; }
+        case AdaptiveJobCount: {
+            serverOpts.options |= Server::AdaptiveJobCount;
+            break; }
+        case LazyTokens: {
+            serverOpts.options |= Server::LazyTokens;
+            break; }
+        case ResidentTranslationUnits: {
+            serverOpts.options |= Server::ResidentTranslationUnits;
+            break; }
+        case CompletionThreads: {
+            serverOpts.completionThreads = atoi(value.constData());
+            if (serverOpts.completionThreads <= 0) {
+                return { String::format<1024>("Invalid argument to --completion-threads %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case MaxCompletions: {
+            serverOpts.maxCompletions = atoi(value.constData());
+            if (serverOpts.maxCompletions < 0) {
+                return { String::format<1024>("Invalid argument to --max-completions %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case CompletionCacheMemory: {
+            serverOpts.completionCacheMemory = atoi(value.constData());
+            if (serverOpts.completionCacheMemory < 0) {
+                return { String::format<1024>("Invalid argument to --completion-cache-memory %s", value.constData()), CommandLineParser::Parse_Error };
+            }
+            break; }
+        case SpeculativeCompletions: {
+            serverOpts.options |= Server::SpeculativeCompletions;
+            break; }
         }
 
         return { String(), CommandLineParser::Parse_Exec };
@@ -20,6 +20,7 @@
 #include "ClangIndexer.h"
 #include "Project.h"
 #include "rct/Log.h"
+#include "rct/Set.h"
 #include "rct/StopWatch.h"
 #include "rct/String.h"
 #include "RTags.h"
@@ -56,16 +57,66 @@ public:
     }
 };
 
+// rdm keeps one rp around with --resident for the active buffers. Jobs come
+// in with the same framing as usual, a size of 0 is followed by the list of
+// file ids whose translation units are worth keeping. Every job is answered
+// with @RESIDENT@<status>@RESIDENT@ on stdout.
+static int runResident()
+{
+    ClangIndexer::setResident(true);
+    while (true) {
+        uint32_t size;
+        if (!fread(&size, sizeof(size), 1, stdin))
+            return 0;
+        if (!size) {
+            uint32_t count;
+            if (!fread(&count, sizeof(count), 1, stdin)) {
+                error() << "Failed to read from stdin";
+                return 1;
+            }
+            Set<uint32_t> fileIds;
+            for (uint32_t i=0; i<count; ++i) {
+                uint32_t fileId;
+                if (!fread(&fileId, sizeof(fileId), 1, stdin)) {
+                    error() << "Failed to read from stdin";
+                    return 1;
+                }
+                fileIds.insert(fileId);
+            }
+            ClangIndexer::retainResidentUnits(fileIds);
+            continue;
+        }
+        String data;
+        data.resize(size);
+        if (!fread(&data[0], size, 1, stdin)) {
+            error() << "Failed to read from stdin";
+            return 2;
+        }
+        bool ok;
+        {
+            ClangIndexer indexer;
+            ok = indexer.exec(data);
+        }
+        if (!ok)
+            error() << "ClangIndexer error";
+        printf("@RESIDENT@%d@RESIDENT@", ok ? 0 : 1);
+        fflush(stdout);
+    }
+}
+
 int main(int argc, char **argv)
 {
     LogLevel logLevel = LogLevel::Error;
     Path file;
+    bool resident = false;
 
     for (int i=1; i<argc; ++i) {
         if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
             ++logLevel;
         } else if (!strcmp(argv[i], "--priority")) { // ignore, only for wrapping purposes
             ++i;
+        } else if (!strcmp(argv[i], "--resident")) {
+            resident = true;
         } else {
             file = argv[i];
         }
@@ -88,6 +139,9 @@ int main(int argc, char **argv)
     RTags::initMessages();
     auto eventLoop = std::make_shared<EventLoop>();
     eventLoop->init(EventLoop::MainEventLoop);
+    if (resident)
+        return runResident();
+
     String data;
 
     if (!file.isEmpty()) {